@@ -0,0 +1,379 @@
+/*
+ * Glue Code for the bit-sliced NEON version of the AES Cipher Algorithm
+ *
+ * CBC decryption and XTS run eight blocks at a time through
+ * aesbs-core.S.  CBC encryption is serial, so it and any tail shorter
+ * than eight blocks use the scalar aes-armv4.S, as does everything when
+ * NEON cannot be used from the calling context.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <asm/neon.h>
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/b128ops.h>
+#include <crypto/gf128mul.h>
+#include <linux/hardirq.h>
+#include <linux/module.h>
+
+#define BS_BLOCKS	8
+#define BS_BYTES	(BS_BLOCKS * AES_BLOCK_SIZE)
+
+/* eight bit planes per round, plus the last round key as is */
+#define BS_KEY_SIZE	(14 * BS_BYTES + AES_BLOCK_SIZE)
+
+asmlinkage void aes_enc_blk(struct crypto_aes_ctx *ctx, u8 *out, const u8 *in);
+asmlinkage void aes_dec_blk(struct crypto_aes_ctx *ctx, u8 *out, const u8 *in);
+
+asmlinkage void aesbs_encrypt8(u8 *blocks, const u8 *bskey, int rounds);
+asmlinkage void aesbs_decrypt8(u8 *blocks, const u8 *bskey, int rounds);
+
+struct aesbs_key {
+	int	rounds;
+	u8	rk[BS_KEY_SIZE];
+};
+
+struct aesbs_cbc_ctx {
+	struct crypto_aes_ctx	aes;
+	struct aesbs_key	dec;
+};
+
+struct aesbs_xts_ctx {
+	struct crypto_aes_ctx	aes;
+	struct crypto_aes_ctx	twkey;
+	struct aesbs_key	enc;
+	struct aesbs_key	dec;
+};
+
+/*
+ * Spread each round key over eight bit planes, one 0x00/0xff byte per
+ * state byte.  The first key is added to the blocks as loaded, column
+ * major; the others meet the row major state inside the rounds.  The
+ * S-box circuits leave out the 0x63 constant: on encryption it is added
+ * to every key after the first, on decryption to every key but the last.
+ */
+static void aesbs_convert_key(struct aesbs_key *bk, const u32 *rk,
+			      int rounds, bool enc)
+{
+	u8 *out = bk->rk;
+	int r, i, p;
+
+	bk->rounds = rounds;
+	for (r = 0; r < rounds; r++) {
+		const u8 *k = (const u8 *)(rk + 4 * r);
+		u8 c = (r || !enc) ? 0x63 : 0;
+
+		for (i = 0; i < 8; i++) {
+			for (p = 0; p < 16; p++) {
+				u8 b = r ? k[4 * (p % 4) + p / 4] : k[p];
+
+				*out++ = ((b ^ c) >> i) & 1 ? 0xff : 0;
+			}
+		}
+	}
+
+	memcpy(out, rk + 4 * rounds, AES_BLOCK_SIZE);
+	if (enc)
+		for (p = 0; p < AES_BLOCK_SIZE; p++)
+			out[p] ^= 0x63;
+}
+
+static int aesbs_expand_key(struct crypto_tfm *tfm, struct crypto_aes_ctx *ctx,
+			    const u8 *in_key, unsigned int key_len)
+{
+	int ret;
+
+	ret = crypto_aes_expand_key(ctx, in_key, key_len);
+	if (ret)
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+	return ret;
+}
+
+static int aesbs_cbc_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			     unsigned int key_len)
+{
+	struct aesbs_cbc_ctx *ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
+	ret = aesbs_expand_key(tfm, &ctx->aes, in_key, key_len);
+	if (ret)
+		return ret;
+
+	aesbs_convert_key(&ctx->dec, ctx->aes.key_dec, key_len / 4 + 6, false);
+	return 0;
+}
+
+static int aesbs_xts_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+			     unsigned int key_len)
+{
+	struct aesbs_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
+	/* the data key comes first, then the tweak key of the same size */
+	if (key_len % 2) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	key_len /= 2;
+
+	ret = aesbs_expand_key(tfm, &ctx->aes, in_key, key_len);
+	if (!ret)
+		ret = aesbs_expand_key(tfm, &ctx->twkey, in_key + key_len,
+				       key_len);
+	if (ret)
+		return ret;
+
+	aesbs_convert_key(&ctx->enc, ctx->aes.key_enc, key_len / 4 + 6, true);
+	aesbs_convert_key(&ctx->dec, ctx->aes.key_dec, key_len / 4 + 6, false);
+	return 0;
+}
+
+/*
+ * Each walk step runs in its own kernel_neon_begin() section, since
+ * blkcipher_walk_done() may sleep.  Callers already inside a section,
+ * such as a NEON memcpy(), or in interrupt context get the scalar code.
+ */
+static inline bool aesbs_neon_usable(void)
+{
+	return !in_interrupt() && !kernel_neon_busy();
+}
+
+static int aesbs_cbc_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst,
+			     struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_cbc_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *in = walk.src.virt.addr;
+		u8 *out = walk.dst.virt.addr;
+
+		do {
+			crypto_xor(walk.iv, in, AES_BLOCK_SIZE);
+			aes_enc_blk(&ctx->aes, out, walk.iv);
+			memcpy(walk.iv, out, AES_BLOCK_SIZE);
+			in += AES_BLOCK_SIZE;
+			out += AES_BLOCK_SIZE;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int aesbs_cbc_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst,
+			     struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_cbc_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	u8 buf[BS_BYTES];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, BS_BYTES);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *in = walk.src.virt.addr;
+		u8 *out = walk.dst.virt.addr;
+		bool neon = aesbs_neon_usable();
+
+		if (neon)
+			kernel_neon_begin();
+
+		/* dst may alias src, so keep the ciphertext until it is used */
+		while (neon && nbytes >= BS_BYTES) {
+			memcpy(buf, in, BS_BYTES);
+			aesbs_decrypt8(buf, ctx->dec.rk, ctx->dec.rounds);
+			crypto_xor(buf, walk.iv, AES_BLOCK_SIZE);
+			crypto_xor(buf + AES_BLOCK_SIZE, in,
+				   BS_BYTES - AES_BLOCK_SIZE);
+			memcpy(walk.iv, in + BS_BYTES - AES_BLOCK_SIZE,
+			       AES_BLOCK_SIZE);
+			memcpy(out, buf, BS_BYTES);
+			in += BS_BYTES;
+			out += BS_BYTES;
+			nbytes -= BS_BYTES;
+		}
+
+		while (nbytes >= AES_BLOCK_SIZE) {
+			memcpy(buf, in, AES_BLOCK_SIZE);
+			aes_dec_blk(&ctx->aes, out, in);
+			crypto_xor(out, walk.iv, AES_BLOCK_SIZE);
+			memcpy(walk.iv, buf, AES_BLOCK_SIZE);
+			in += AES_BLOCK_SIZE;
+			out += AES_BLOCK_SIZE;
+			nbytes -= AES_BLOCK_SIZE;
+		}
+
+		if (neon)
+			kernel_neon_end();
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int aesbs_xts_crypt(struct blkcipher_desc *desc,
+			   struct scatterlist *dst,
+			   struct scatterlist *src, unsigned int nbytes,
+			   bool enc)
+{
+	struct aesbs_xts_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct aesbs_key *bk = enc ? &ctx->enc : &ctx->dec;
+	struct blkcipher_walk walk;
+	u8 buf[BS_BYTES], tw[BS_BYTES];
+	int err, i;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, BS_BYTES);
+	if (!walk.nbytes)
+		return err;
+
+	/* the first tweak is the IV encrypted with the second key */
+	aes_enc_blk(&ctx->twkey, walk.iv, walk.iv);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *in = walk.src.virt.addr;
+		u8 *out = walk.dst.virt.addr;
+		bool neon = aesbs_neon_usable();
+
+		if (neon)
+			kernel_neon_begin();
+
+		while (neon && nbytes >= BS_BYTES) {
+			for (i = 0; i < BS_BYTES; i += AES_BLOCK_SIZE) {
+				memcpy(tw + i, walk.iv, AES_BLOCK_SIZE);
+				gf128mul_x_ble((be128 *)walk.iv,
+					       (be128 *)walk.iv);
+			}
+			memcpy(buf, in, BS_BYTES);
+			crypto_xor(buf, tw, BS_BYTES);
+			if (enc)
+				aesbs_encrypt8(buf, bk->rk, bk->rounds);
+			else
+				aesbs_decrypt8(buf, bk->rk, bk->rounds);
+			crypto_xor(buf, tw, BS_BYTES);
+			memcpy(out, buf, BS_BYTES);
+			in += BS_BYTES;
+			out += BS_BYTES;
+			nbytes -= BS_BYTES;
+		}
+
+		while (nbytes >= AES_BLOCK_SIZE) {
+			memcpy(buf, in, AES_BLOCK_SIZE);
+			crypto_xor(buf, walk.iv, AES_BLOCK_SIZE);
+			if (enc)
+				aes_enc_blk(&ctx->aes, out, buf);
+			else
+				aes_dec_blk(&ctx->aes, out, buf);
+			crypto_xor(out, walk.iv, AES_BLOCK_SIZE);
+			gf128mul_x_ble((be128 *)walk.iv, (be128 *)walk.iv);
+			in += AES_BLOCK_SIZE;
+			out += AES_BLOCK_SIZE;
+			nbytes -= AES_BLOCK_SIZE;
+		}
+
+		if (neon)
+			kernel_neon_end();
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int aesbs_xts_encrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst,
+			     struct scatterlist *src, unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int aesbs_xts_decrypt(struct blkcipher_desc *desc,
+			     struct scatterlist *dst,
+			     struct scatterlist *src, unsigned int nbytes)
+{
+	return aesbs_xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static struct crypto_alg aesbs_algs[] = { {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_cbc_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesbs_algs[0].cra_list),
+	.cra_u	= {
+		.blkcipher	= {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_cbc_set_key,
+			.encrypt	= aesbs_cbc_encrypt,
+			.decrypt	= aesbs_cbc_decrypt
+		}
+	}
+}, {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "xts-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_xts_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aesbs_algs[1].cra_list),
+	.cra_u	= {
+		.blkcipher	= {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_xts_set_key,
+			.encrypt	= aesbs_xts_encrypt,
+			.decrypt	= aesbs_xts_decrypt
+		}
+	}
+} };
+
+static int __init aesbs_init(void)
+{
+	int ret;
+
+	if (!cpu_has_neon())
+		return -ENODEV;
+
+	ret = crypto_register_alg(&aesbs_algs[0]);
+	if (ret)
+		return ret;
+
+	ret = crypto_register_alg(&aesbs_algs[1]);
+	if (ret)
+		crypto_unregister_alg(&aesbs_algs[0]);
+
+	return ret;
+}
+
+static void __exit aesbs_fini(void)
+{
+	crypto_unregister_alg(&aesbs_algs[1]);
+	crypto_unregister_alg(&aesbs_algs[0]);
+}
+
+module_init(aesbs_init);
+module_exit(aesbs_fini);
+
+MODULE_DESCRIPTION("Bit-sliced AES in CBC and XTS modes using NEON");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("cbc(aes)");
+MODULE_ALIAS("xts(aes)");
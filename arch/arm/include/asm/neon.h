@@ -0,0 +1,60 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+/*
+ * memcpy(), memset() and __memzero() hand copies of at least this many
+ * bytes to the NEON routines in arch/arm/lib/neon-copy.c.  Below it,
+ * saving a live VFP context costs more than NEON gains.
+ */
+#define NEON_COPY_MIN		1024
+
+/*
+ * Large copies are split into sections of at most this many bytes, each
+ * with preemption disabled, so a multi-megabyte memcpy() does not hold
+ * off the scheduler for its whole length.
+ */
+#define NEON_COPY_CHUNK		(16 * 1024)
+
+#ifndef __ASSEMBLY__
+
+#include <linux/types.h>
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+/*
+ * Use NEON from kernel code.  The section in between runs with
+ * preemption disabled and must not sleep; it may not be entered from
+ * interrupt context, nor from inside another section.  Code that can be
+ * reached either way checks kernel_neon_busy() and in_interrupt() first.
+ */
+extern void kernel_neon_begin(void);
+extern void kernel_neon_end(void);
+extern bool kernel_neon_busy(void);
+
+/*
+ * The ARM and NEON string routines behind copy_page(), clear_page(),
+ * memcpy() and memset().  The NEON ones must be called between
+ * kernel_neon_begin() and kernel_neon_end() and need n >= 64.
+ */
+extern void __copy_page_arm(void *to, const void *from);
+extern void *__memcpy_arm(void *to, const void *from, size_t n);
+extern void __memset_arm(void *p, int c, size_t n);
+extern void __memzero_arm(void *p, size_t n);
+
+extern void __copy_page_neon(void *to, const void *from);
+extern void __clear_page_neon(void *page);
+extern void __memcpy_neon(void *to, const void *from, size_t n);
+extern void __memset_neon(void *p, int c, size_t n);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* __ASM_ARM_NEON_H */
@@ -117,6 +117,8 @@ extern void iwmmxt_task_switch(struct thread_info *);
 
 extern void vfp_sync_hwstate(struct thread_info *);
 extern void vfp_flush_hwstate(struct thread_info *);
+extern void vfp_pm_save_context(void);
+extern void vfp_pm_restore_context(void);
 
 #endif
 
@@ -0,0 +1,197 @@
+/*
+ *  linux/arch/arm/lib/neon-copy-bench.c
+ *
+ *  Microbenchmark for the ARM and NEON copy routines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Loading the module times every routine over a range of sizes with the
+ * ARMv7 cycle counter and prints the throughput in bytes per cycle.  The
+ * NEON numbers include kernel_neon_begin()/kernel_neon_end() on every
+ * call, so they show where NEON_COPY_MIN should sit.  Like tcrypt, the
+ * module refuses to stay loaded so it can simply be loaded again.
+ */
+#include <linux/init.h>
+#include <linux/irqflags.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/vmalloc.h>
+
+#include <asm/neon.h>
+#include <asm/page.h>
+
+#define BENCH_BUF_SIZE		(1024 * 1024)
+
+static unsigned int iterations = 32;
+module_param(iterations, uint, 0);
+MODULE_PARM_DESC(iterations, "Calls per routine and size");
+
+static unsigned int offset;
+module_param(offset, uint, 0);
+MODULE_PARM_DESC(offset, "Misalignment of the memcpy source in bytes");
+
+static const size_t bench_sizes[] = {
+	256, 1024, 4096, 16 * 1024, 64 * 1024, 256 * 1024, BENCH_BUF_SIZE,
+};
+
+static void bench_copy_page_arm(void *dst, void *src, size_t n)
+{
+	__copy_page_arm(dst, src);
+}
+
+static void bench_copy_page_neon(void *dst, void *src, size_t n)
+{
+	kernel_neon_begin();
+	__copy_page_neon(dst, src);
+	kernel_neon_end();
+}
+
+static void bench_clear_page_arm(void *dst, void *src, size_t n)
+{
+	__memzero_arm(dst, PAGE_SIZE);
+}
+
+static void bench_clear_page_neon(void *dst, void *src, size_t n)
+{
+	kernel_neon_begin();
+	__clear_page_neon(dst);
+	kernel_neon_end();
+}
+
+static void bench_memcpy_arm(void *dst, void *src, size_t n)
+{
+	__memcpy_arm(dst, src + offset, n);
+}
+
+static void bench_memcpy_neon(void *dst, void *src, size_t n)
+{
+	kernel_neon_begin();
+	__memcpy_neon(dst, src + offset, n);
+	kernel_neon_end();
+}
+
+static void bench_memset_arm(void *dst, void *src, size_t n)
+{
+	__memset_arm(dst, 0x5a, n);
+}
+
+static void bench_memset_neon(void *dst, void *src, size_t n)
+{
+	kernel_neon_begin();
+	__memset_neon(dst, 0x5a, n);
+	kernel_neon_end();
+}
+
+static const struct bench {
+	const char *name;
+	void (*fn)(void *dst, void *src, size_t n);
+	int page;			/* PAGE_SIZE only */
+} benches[] = {
+	{ "copy_page_arm",	bench_copy_page_arm,	1 },
+	{ "copy_page_neon",	bench_copy_page_neon,	1 },
+	{ "clear_page_arm",	bench_clear_page_arm,	1 },
+	{ "clear_page_neon",	bench_clear_page_neon,	1 },
+	{ "memcpy_arm",		bench_memcpy_arm,	0 },
+	{ "memcpy_neon",	bench_memcpy_neon,	0 },
+	{ "memset_arm",		bench_memset_arm,	0 },
+	{ "memset_neon",	bench_memset_neon,	0 },
+};
+
+static inline u32 ccnt_read(void)
+{
+	u32 val;
+
+	asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r" (val));
+	return val;
+}
+
+/* Run the cycle counter undivided; hand back what was there before. */
+static void ccnt_start(u32 *pmcr, u32 *cnten)
+{
+	asm volatile("mrc p15, 0, %0, c9, c12, 0" : "=r" (*pmcr));
+	asm volatile("mrc p15, 0, %0, c9, c12, 1" : "=r" (*cnten));
+	asm volatile("mcr p15, 0, %0, c9, c12, 0" : : "r" ((*pmcr | 1) & ~8));
+	asm volatile("mcr p15, 0, %0, c9, c12, 1" : : "r" (1 << 31));
+}
+
+static void ccnt_stop(u32 pmcr, u32 cnten)
+{
+	asm volatile("mcr p15, 0, %0, c9, c12, 2" : : "r" (~cnten & (1 << 31)));
+	asm volatile("mcr p15, 0, %0, c9, c12, 0" : : "r" (pmcr));
+}
+
+static void run_bench(const struct bench *b, void *dst, void *src, size_t n)
+{
+	u64 cycles = 0;
+	unsigned long flags;
+	unsigned int i;
+	u32 start, bpc;
+
+	/* warm up */
+	b->fn(dst, src, n);
+
+	for (i = 0; i < iterations; i++) {
+		local_irq_save(flags);
+		start = ccnt_read();
+		b->fn(dst, src, n);
+		cycles += ccnt_read() - start;
+		local_irq_restore(flags);
+	}
+
+	bpc = div64_u64((u64)n * iterations * 1000, cycles ? cycles : 1);
+	printk(KERN_INFO "neon-copy-bench: %-16s %8zu bytes: %u.%03u bytes/cycle\n",
+	       b->name, n, bpc / 1000, bpc % 1000);
+}
+
+static int __init neon_copy_bench_init(void)
+{
+	u32 pmcr, cnten;
+	void *src, *dst;
+	int i, j;
+
+	if (!cpu_has_neon()) {
+		printk(KERN_ERR "neon-copy-bench: no NEON\n");
+		return -ENODEV;
+	}
+
+	offset &= 63;
+	src = vmalloc(BENCH_BUF_SIZE + 64);
+	dst = vmalloc(BENCH_BUF_SIZE);
+	if (!src || !dst) {
+		vfree(src);
+		vfree(dst);
+		return -ENOMEM;
+	}
+	memset(src, 0xa5, BENCH_BUF_SIZE + 64);
+	memset(dst, 0, BENCH_BUF_SIZE);
+
+	ccnt_start(&pmcr, &cnten);
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		if (benches[i].page) {
+			run_bench(&benches[i], dst, src, PAGE_SIZE);
+			continue;
+		}
+		for (j = 0; j < ARRAY_SIZE(bench_sizes); j++)
+			run_bench(&benches[i], dst, src, bench_sizes[j]);
+	}
+
+	ccnt_stop(pmcr, cnten);
+
+	vfree(src);
+	vfree(dst);
+
+	return -EAGAIN;
+}
+
+static void __exit neon_copy_bench_exit(void) { }
+
+module_init(neon_copy_bench_init);
+module_exit(neon_copy_bench_exit);
+
+MODULE_DESCRIPTION("ARM/NEON copy routine microbenchmark");
+MODULE_LICENSE("GPL");
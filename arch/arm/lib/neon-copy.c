@@ -0,0 +1,151 @@
+/*
+ *  linux/arch/arm/lib/neon-copy.c
+ *
+ *  Page copy/clear and large memcpy/memset using NEON
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * memcpy(), memset() and __memzero() branch here for copies of at least
+ * NEON_COPY_MIN bytes; copy_page() and clear_page() always come here.
+ * Until vfp_init() has found NEON, whenever we are called from interrupt
+ * context, and when the caller is already using NEON (a memcpy() from
+ * inside a NEON crypto routine, say), everything goes to the ARM routines
+ * instead.  Large copies drop out of NEON every NEON_COPY_CHUNK bytes so
+ * that preemption is not held off for the whole copy.
+ */
+#include <linux/hardirq.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include <asm/neon.h>
+#include <asm/page.h>
+
+/* for the benchmark module */
+EXPORT_SYMBOL_GPL(__copy_page_arm);
+EXPORT_SYMBOL_GPL(__memcpy_arm);
+EXPORT_SYMBOL_GPL(__memset_arm);
+EXPORT_SYMBOL_GPL(__memzero_arm);
+EXPORT_SYMBOL_GPL(__copy_page_neon);
+EXPORT_SYMBOL_GPL(__clear_page_neon);
+EXPORT_SYMBOL_GPL(__memcpy_neon);
+EXPORT_SYMBOL_GPL(__memset_neon);
+
+static int neon_copy __read_mostly;
+static int noneoncopy __initdata;
+
+static int __init noneoncopy_setup(char *str)
+{
+	noneoncopy = 1;
+	return 1;
+}
+__setup("noneoncopy", noneoncopy_setup);
+
+static inline int neon_copy_usable(void)
+{
+	return neon_copy && !in_interrupt() && !kernel_neon_busy();
+}
+
+/* Never leave a tail shorter than the 64 bytes the NEON routines need */
+static inline size_t neon_copy_chunk(size_t n)
+{
+	return n < NEON_COPY_CHUNK + 64 ? n : NEON_COPY_CHUNK;
+}
+
+void copy_page(void *to, const void *from)
+{
+	if (!neon_copy_usable()) {
+		__copy_page_arm(to, from);
+		return;
+	}
+
+	kernel_neon_begin();
+	__copy_page_neon(to, from);
+	kernel_neon_end();
+}
+
+void clear_page(void *page)
+{
+	if (!neon_copy_usable()) {
+		__memzero_arm(page, PAGE_SIZE);
+		return;
+	}
+
+	kernel_neon_begin();
+	__clear_page_neon(page);
+	kernel_neon_end();
+}
+EXPORT_SYMBOL(clear_page);
+
+void *memcpy_large(void *to, const void *from, size_t n)
+{
+	void *d = to;
+
+	if (!neon_copy_usable())
+		return __memcpy_arm(to, from, n);
+
+	while (n) {
+		size_t chunk = neon_copy_chunk(n);
+
+		kernel_neon_begin();
+		__memcpy_neon(d, from, chunk);
+		kernel_neon_end();
+
+		d += chunk;
+		from += chunk;
+		n -= chunk;
+	}
+	return to;
+}
+
+static void memset_chunked(void *p, int c, size_t n)
+{
+	while (n) {
+		size_t chunk = neon_copy_chunk(n);
+
+		kernel_neon_begin();
+		__memset_neon(p, c, chunk);
+		kernel_neon_end();
+
+		p += chunk;
+		n -= chunk;
+	}
+}
+
+void *memset_large(void *p, int c, size_t n)
+{
+	if (!neon_copy_usable()) {
+		__memset_arm(p, c, n);
+		return p;
+	}
+
+	memset_chunked(p, c, n);
+	return p;
+}
+
+void __memzero_large(void *p, size_t n)
+{
+	if (!neon_copy_usable()) {
+		__memzero_arm(p, n);
+		return;
+	}
+
+	memset_chunked(p, 0, n);
+}
+
+/*
+ * vfp_init() probes for NEON at late_initcall time, so only look at the
+ * hwcaps once every late_initcall has run.
+ */
+static int __init neon_copy_init(void)
+{
+	if (!cpu_has_neon() || noneoncopy)
+		return 0;
+
+	neon_copy = 1;
+	printk(KERN_INFO "NEON: using NEON for page and large memory copies\n");
+	return 0;
+}
+late_initcall_sync(neon_copy_init);
@@ -21,6 +21,9 @@
 #include <linux/regulator/consumer.h>
 #include <linux/cpufreq.h>
 #include <linux/platform_device.h>
+#include <linux/workqueue.h>
+#include <linux/perf_event.h>
+#include <linux/pm_qos_params.h>
 
 #include <mach/map.h>
 #include <mach/regs-clock.h>
@@ -36,6 +39,10 @@ static DEFINE_MUTEX(set_freq_lock);
 #define APLL_VAL_1200	((1 << 31) | (150 << 16) | (3 << 8) | 1)
 #define APLL_VAL_1000	((1 << 31) | (125 << 16) | (3 << 8) | 1)
 #define APLL_VAL_800	((1 << 31) | (100 << 16) | (3 << 8) | 1)
+#define APLL_PMS_MASK	((0x3ff << 16) | (0x3f << 8) | 0x7)
+
+#define FIN_KHZ		24000
+#define MPLL_KHZ	667000
 
 #define SLEEP_FREQ	(800 * 1000) /* Use 800MHz when entering sleep */
 
@@ -73,87 +80,153 @@ enum s5pv210_dmc_port {
 	DMC1,
 };
 
-static struct cpufreq_frequency_table s5pv210_freq_table[] = {
-	{OC0, 1200*1000},
-	{L0, 1000*1000},
-	{L1, 800*1000},
-	{L2, 400*1000},
-	{L3, 200*1000},
-	{L4, 100*1000},
-	{0, CPUFREQ_TABLE_END},
-};
+/* Filled from s5pv210_levels[] at probe */
+static struct cpufreq_frequency_table s5pv210_freq_table[MAX_PERF_LEVEL + 2];
 
 static struct regulator *arm_regulator;
 static struct regulator *internal_regulator;
 
-struct s5pv210_dvs_conf {
-	unsigned long	arm_volt; /* uV */
-	unsigned long	int_volt; /* uV */
-};
+static bool s5pv210_volt_supported(struct regulator *regulator,
+				   unsigned long uV)
+{
+	if (IS_ERR_OR_NULL(regulator))
+		return true;
 
-#ifdef CONFIG_DVFS_LIMIT
-static unsigned int g_dvfs_high_lock_token = 0;
-static unsigned int g_dvfs_high_lock_limit = 6;
-static unsigned int g_dvfslockval[DVFS_LOCK_TOKEN_NUM];
-//static DEFINE_MUTEX(dvfs_high_lock);
-#endif
+	/* a regulator that cannot list its voltages is trusted */
+	return regulator_is_supported_voltage(regulator, uV, uV) != 0;
+}
 
 const unsigned long arm_volt_max = 1350000;
 const unsigned long int_volt_max = 1250000;
 
-static struct s5pv210_dvs_conf dvs_conf[] = {
+/* Clock dividers programmed for each level */
+enum s5pv210_clkdiv {
+	DIV_APLL,
+	DIV_A2M,
+	DIV_HCLK_MSYS,
+	DIV_PCLK_MSYS,
+	DIV_HCLK_DSYS,
+	DIV_PCLK_DSYS,
+	DIV_HCLK_PSYS,
+	DIV_PCLK_PSYS,
+	DIV_ONEDRAM,
+	DIV_MFC,
+	DIV_G3D,
+	DIV_NR,
+};
+
+/*
+ * One performance level. clkdiv holds the ratios with the memory bus
+ * at full speed. hclk_msys_low and onedram_low replace the DMC1 and
+ * DMC0 ratios while the bus is scaled down on its own.
+ */
+struct s5pv210_freq_level {
+	unsigned int	freq;		/* kHz */
+	u32		apll;		/* APLL_CON, source of ARMCLK */
+	unsigned long	arm_volt;	/* uV */
+	unsigned long	int_volt;	/* uV */
+	u32		mcs;		/* ARM_MCS_CON margin */
+	u32		clkdiv[DIV_NR];
+	u32		hclk_msys_low;
+	u32		onedram_low;
+};
+
+static struct s5pv210_freq_level s5pv210_levels[] = {
+	/* OC0 : [1200/200/100][166/83][133/66][200/200] */
 	[OC0] = {
-		.arm_volt   = 1275000,
-		.int_volt   = 1100000,
+		.freq		= 1200 * 1000,
+		.apll		= APLL_VAL_1200,
+		.arm_volt	= 1275000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 0, 5, 5, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 7,
+		.onedram_low	= 7,
 	},
+	/* L0 : [1000/200/100][166/83][133/66][200/200] */
 	[L0] = {
-		.arm_volt   = 1275000,
-		.int_volt   = 1100000,
+		.freq		= 1000 * 1000,
+		.apll		= APLL_VAL_1000,
+		.arm_volt	= 1275000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 0, 4, 4, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 7,
+		.onedram_low	= 7,
 	},
+	/* L1 : [800/200/100][166/83][133/66][200/200] */
 	[L1] = {
-		.arm_volt   = 1200000,
-		.int_volt   = 1100000,
+		.freq		= 800 * 1000,
+		.apll		= APLL_VAL_800,
+		.arm_volt	= 1200000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 0, 3, 3, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 7,
+		.onedram_low	= 7,
 	},
+	/* L1_1 : [600/200/100][166/83][133/66][200/200] */
+	[L1_1] = {
+		.freq		= 600 * 1000,
+		.apll		= APLL_VAL_1200,
+		.arm_volt	= 1125000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 1, 5, 2, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 5,
+		.onedram_low	= 7,
+	},
+	/* L2 : [400/200/100][166/83][133/66][200/200] */
 	[L2] = {
-		.arm_volt   = 1050000,
-		.int_volt   = 1100000,
+		.freq		= 400 * 1000,
+		.apll		= APLL_VAL_800,
+		.arm_volt	= 1050000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 1, 3, 1, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 3,
+		.onedram_low	= 7,
 	},
+	/* L2_1 : [300/150/75][166/83][133/66][200/200] */
+	[L2_1] = {
+		.freq		= 300 * 1000,
+		.apll		= APLL_VAL_1200,
+		.arm_volt	= 1000000,
+		.int_volt	= 1100000,
+		.mcs		= 0x1,
+		.clkdiv		= { 3, 5, 1, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 2,
+		.onedram_low	= 7,
+	},
+	/* L3 : [200/200/100][166/83][133/66][200/200] */
 	[L3] = {
-		.arm_volt   = 950000,
-		.int_volt   = 1100000,
+		.freq		= 200 * 1000,
+		.apll		= APLL_VAL_800,
+		.arm_volt	= 950000,
+		.int_volt	= 1100000,
+		.mcs		= 0x3,
+		.clkdiv		= { 3, 3, 0, 1, 3, 1, 4, 1, 3, 0, 0 },
+		.hclk_msys_low	= 1,
+		.onedram_low	= 7,
 	},
+	/* L4 : [100/100/100][83/83][66/66][100/100] */
 	[L4] = {
-		.arm_volt   = 950000,
-		.int_volt   = 1000000,
+		.freq		= 100 * 1000,
+		.apll		= APLL_VAL_800,
+		.arm_volt	= 950000,
+		.int_volt	= 1000000,
+		.mcs		= 0x3,
+		.clkdiv		= { 7, 7, 0, 0, 7, 0, 9, 0, 7, 0, 0 },
+		.hclk_msys_low	= 0,
+		.onedram_low	= 7,
 	},
 };
 
-static u32 clkdiv_val[6][11] = {
-	/*
-	 * Clock divider value for following
-	 * { APLL, A2M, HCLK_MSYS, PCLK_MSYS,
-	 *   HCLK_DSYS, PCLK_DSYS, HCLK_PSYS, PCLK_PSYS,
-	 *   ONEDRAM, MFC, G3D }
-	 */
-
-	/* OC0 : [1200/200/100][166/83][133/66][200/200] */
-	{0, 5, 5, 1, 3, 1, 4, 1, 3, 0, 0},
-
-	/* L0 : [1000/200/100][166/83][133/66][200/200] */
-	{0, 4, 4, 1, 3, 1, 4, 1, 3, 0, 0},
-
-	/* L1 : [800/200/100][166/83][133/66][200/200] */
-	{0, 3, 3, 1, 3, 1, 4, 1, 3, 0, 0},
-
-	/* L2 : [400/200/100][166/83][133/66][200/200] */
-	{1, 3, 1, 1, 3, 1, 4, 1, 3, 0, 0},
-
-	/* L3 : [200/200/100][166/83][133/66][200/200] */
-	{3, 3, 0, 1, 3, 1, 4, 1, 3, 0, 0},
+/* Level last programmed by s5pv210_target(), -1 until the first one */
+static int cur_level = -1;
 
-	/* L4 : [100/100/100][83/83][66/66][100/100] */
-	{7, 7, 0, 0, 7, 0, 9, 0, 7, 0, 0},
-};
+/* DMC0 and DMC1 run at their low ratios */
+static bool bus_low;
 
 /*
  * This function set DRAM refresh counter
@@ -203,158 +276,134 @@ unsigned int s5pv210_getspeed(unsigned int cpu)
 	return clk_get_rate(cpu_clk) / 1000;
 }
 
-#ifdef CONFIG_DVFS_LIMIT
-void s5pv210_lock_dvfs_high_level(uint nToken, uint perf_level)
+static unsigned long s5pv210_apll_khz(u32 apll_con)
 {
-	uint freq_level;
-	struct cpufreq_policy *policy;
-
-	//printk(KERN_DEBUG "%s : lock with token(%d) level(%d) current(%X)\n",
-	//		__func__, nToken, perf_level, g_dvfs_high_lock_token);
-
-	if (g_dvfs_high_lock_token & (1 << nToken))
-		return;
+	unsigned long mdiv = (apll_con >> 16) & 0x3ff;
+	unsigned long pdiv = (apll_con >> 8) & 0x3f;
+	unsigned long sdiv = apll_con & 0x7;
 
-	if (perf_level > (MAX_PERF_LEVEL - 1))
-		return;
-
-	//mutex_lock(&dvfs_high_lock);
-
-	g_dvfs_high_lock_token |= (1 << nToken);
-	g_dvfslockval[nToken] = perf_level;
-
-	if (perf_level <  g_dvfs_high_lock_limit)
-		g_dvfs_high_lock_limit = perf_level;
-
-	//mutex_unlock(&dvfs_high_lock);
+	return (mdiv * FIN_KHZ / pdiv) >> (sdiv - 1);
+}
 
-	policy = cpufreq_cpu_get(0);
-	if (policy == NULL)
-		return;
+/* HCLK_MSYS, which clocks DMC1, for a MSYS source and CLK_DIV0 ratios */
+static unsigned long s5pv210_dmc1_khz(unsigned long src_khz,
+				      u32 apll_ratio, u32 hclk_ratio)
+{
+	return src_khz / (apll_ratio + 1) / (hclk_ratio + 1);
+}
 
-	freq_level = s5pv210_freq_table[perf_level].frequency;
+/* DMC1 clock of a level with the bus at full or low speed */
+static unsigned long s5pv210_level_dmc1_khz(unsigned int index, bool low)
+{
+	const struct s5pv210_freq_level *lvl = &s5pv210_levels[index];
 
-	cpufreq_driver_target(policy, freq_level, CPUFREQ_RELATION_L);
+	return s5pv210_dmc1_khz(s5pv210_apll_khz(lvl->apll),
+				lvl->clkdiv[DIV_APLL],
+				low ? lvl->hclk_msys_low :
+				      lvl->clkdiv[DIV_HCLK_MSYS]);
 }
-EXPORT_SYMBOL(s5pv210_lock_dvfs_high_level);
 
-void s5pv210_unlock_dvfs_high_level(unsigned int nToken)
+/* Whether the memory bus may scale down at a level without breaking QoS */
+static bool s5pv210_bus_low_allowed(unsigned int index)
 {
-	unsigned int i;
-
-	//mutex_lock(&dvfs_high_lock);
+	return s5pv210_level_dmc1_khz(index, true) >=
+		pm_qos_request(PM_QOS_BUS_DMC_MIN);
+}
 
-	g_dvfs_high_lock_token &= ~(1 << nToken);
-	g_dvfslockval[nToken] = MAX_PERF_LEVEL;
-	g_dvfs_high_lock_limit = MAX_PERF_LEVEL;
+/*
+ * Move a table index onto the slowest valid level meeting the CPU and DMC
+ * minimums, then back under the CPU maximum. The maximum wins when the two
+ * conflict.
+ */
+static unsigned int s5pv210_qos_index(unsigned int index)
+{
+	s32 cpu_min = pm_qos_request(PM_QOS_CPU_FREQ_MIN);
+	s32 cpu_max = pm_qos_request(PM_QOS_CPU_FREQ_MAX);
+	s32 dmc_min = pm_qos_request(PM_QOS_BUS_DMC_MIN);
+	int i;
 
-	if (g_dvfs_high_lock_token) {
-		for (i = 0; i < DVFS_LOCK_TOKEN_NUM; i++) {
-			if (g_dvfslockval[i] < g_dvfs_high_lock_limit)
-				g_dvfs_high_lock_limit = g_dvfslockval[i];
+	/* Levels are ordered from the fastest down */
+	if (s5pv210_levels[index].freq < cpu_min ||
+	    s5pv210_level_dmc1_khz(index, false) < dmc_min) {
+		for (i = index - 1; i >= 0; i--) {
+			if (s5pv210_freq_table[i].frequency ==
+			    CPUFREQ_ENTRY_INVALID)
+				continue;
+			index = i;
+			if (s5pv210_levels[i].freq >= cpu_min &&
+			    s5pv210_level_dmc1_khz(i, false) >= dmc_min)
+				break;
 		}
 	}
 
-	//mutex_unlock(&dvfs_high_lock);
+	if (s5pv210_levels[index].freq > cpu_max) {
+		for (i = index + 1; i <= MAX_PERF_LEVEL; i++) {
+			if (s5pv210_freq_table[i].frequency ==
+			    CPUFREQ_ENTRY_INVALID)
+				continue;
+			index = i;
+			if (s5pv210_levels[i].freq <= cpu_max)
+				break;
+		}
+	}
 
-	//printk(KERN_DEBUG "%s : unlock with token(%d) current(%X) level(%d)\n",
-	//		__func__, nToken, g_dvfs_high_lock_token, g_dvfs_high_lock_limit);
+	return index;
 }
-EXPORT_SYMBOL(s5pv210_unlock_dvfs_high_level);
-#endif
 
-static int s5pv210_target(struct cpufreq_policy *policy,
-			  unsigned int target_freq,
-			  unsigned int relation)
+/*
+ * Switch the clock tree to a level. The caller handles the voltages
+ * and the cpufreq notifications.
+ */
+static void s5pv210_set_level(unsigned int index, bool low)
 {
+	const struct s5pv210_freq_level *lvl = &s5pv210_levels[index];
+	u32 div[DIV_NR];
+	u32 old_apll, old_apll_ratio, old_hclk_ratio, old_onedram;
+	unsigned long dmc0_old, dmc0_new, dmc1_new, dmc1_min;
 	unsigned long reg;
-	unsigned int index;
-	unsigned int pll_changing = 0;
-	unsigned int bus_speed_changing = 0;
-	unsigned int arm_volt, int_volt;
-	int ret = 0;
-
-	mutex_lock(&set_freq_lock);
-
-	if (relation & ENABLE_FURTHER_CPUFREQ)
-		no_cpufreq_access = false;
-	if (no_cpufreq_access) {
-#ifdef CONFIG_PM_VERBOSE
-		pr_err("%s:%d denied access to %s as it is disabled"
-				"temporarily\n", __FILE__, __LINE__, __func__);
-#endif
-		ret = -EINVAL;
-		goto out;
-	}
-	if (relation & DISABLE_FURTHER_CPUFREQ)
-		no_cpufreq_access = true;
-	relation &= ~(ENABLE_FURTHER_CPUFREQ | DISABLE_FURTHER_CPUFREQ);
+	bool pll_changing, bus_speed_changing;
 
-	freqs.old = s5pv210_getspeed(0);
-
-	if (cpufreq_frequency_table_target(policy, s5pv210_freq_table,
-					   target_freq, relation, &index)) {
-		ret = -EINVAL;
-		goto out;
+	memcpy(div, lvl->clkdiv, sizeof(div));
+	if (low) {
+		div[DIV_HCLK_MSYS] = lvl->hclk_msys_low;
+		div[DIV_ONEDRAM] = lvl->onedram_low;
 	}
 
-#ifdef CONFIG_DVFS_LIMIT
-	if (g_dvfs_high_lock_token) {
-		if (index > g_dvfs_high_lock_limit)
-			index = g_dvfs_high_lock_limit;
-	}
-#endif
-
-	freqs.new = s5pv210_freq_table[index].frequency;
-	freqs.cpu = 0;
-
-	if (freqs.new == freqs.old)
-		goto out;
-
-	arm_volt = dvs_conf[index].arm_volt;
-	int_volt = dvs_conf[index].int_volt;
-
-	if (freqs.new > freqs.old) {
-		/* Voltage up code: increase ARM first */
-		if (!IS_ERR_OR_NULL(arm_regulator) &&
-				!IS_ERR_OR_NULL(internal_regulator)) {
-			ret = regulator_set_voltage(arm_regulator,
-						    arm_volt, arm_volt_max);
-			if (ret)
-				goto out;
-			ret = regulator_set_voltage(internal_regulator,
-						    int_volt, int_volt_max);
-			if (ret)
-				goto out;
-		}
+	/* Take the current state from the hardware */
+	old_apll = __raw_readl(S5P_APLL_CON) & APLL_PMS_MASK;
+	reg = __raw_readl(S5P_CLK_DIV0);
+	old_apll_ratio = (reg & S5P_CLKDIV0_APLL_MASK) >> S5P_CLKDIV0_APLL_SHIFT;
+	old_hclk_ratio = (reg & S5P_CLKDIV0_HCLK200_MASK) >>
+			 S5P_CLKDIV0_HCLK200_SHIFT;
+	reg = __raw_readl(S5P_CLK_DIV6);
+	old_onedram = (reg & S5P_CLKDIV6_ONEDRAM_MASK) >>
+		      S5P_CLKDIV6_ONEDRAM_SHIFT;
+
+	pll_changing = old_apll != (lvl->apll & APLL_PMS_MASK);
+	bus_speed_changing = old_onedram != div[DIV_ONEDRAM];
+
+	dmc0_old = MPLL_KHZ / (old_onedram + 1);
+	dmc0_new = MPLL_KHZ / (div[DIV_ONEDRAM] + 1);
+	dmc1_new = s5pv210_dmc1_khz(s5pv210_apll_khz(lvl->apll),
+				    div[DIV_APLL], div[DIV_HCLK_MSYS]);
+	dmc1_min = min(dmc1_new,
+		       s5pv210_dmc1_khz(s5pv210_apll_khz(old_apll),
+					old_apll_ratio, old_hclk_ratio));
+	if (pll_changing) {
+		/* MSYS runs from MPLL with the old and then the new ratios */
+		dmc1_min = min(dmc1_min, s5pv210_dmc1_khz(MPLL_KHZ,
+				old_apll_ratio, old_hclk_ratio));
+		dmc1_min = min(dmc1_min, s5pv210_dmc1_khz(MPLL_KHZ,
+				div[DIV_APLL], div[DIV_HCLK_MSYS]));
 	}
 
-	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
-
-	/* Don't use cpufreq_frequency_table_target() any more as it */
-	/* may not be accurate. Compare against freqs.old instead */
-
-	/* Check if there need to change PLL */
-	if ((index <= L0) || (freqs.old >= s5pv210_freq_table[L0].frequency))
-		pll_changing = 1;
-
-	/* Check if there need to change System bus clock */
-	if ((index == L4) || (freqs.old == s5pv210_freq_table[L4].frequency))
-		bus_speed_changing = 1;
-
-	if (bus_speed_changing) {
-		/*
-		 * Reconfigure DRAM refresh counter value for minimum
-		 * temporary clock while changing divider.
-		 * expected clock is 83Mhz : 7.8usec/(1/83Mhz) = 0x287
-		 */
-		if (pll_changing)
-			s5pv210_set_refresh(DMC1, 83000);
-		else
-			s5pv210_set_refresh(DMC1, 100000);
-
-		s5pv210_set_refresh(DMC0, 83000);
-	}
+	/*
+	 * Program the refresh counters for the slowest clock each DMC sees
+	 * during the switch. Refreshing early at a faster clock is harmless.
+	 */
+	s5pv210_set_refresh(DMC1, dmc1_min);
+	if (bus_speed_changing)
+		s5pv210_set_refresh(DMC0, min(dmc0_old, dmc0_new));
 
 	/*
 	 * APLL should be changed in this level
@@ -393,12 +442,9 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		} while (reg & ((1 << 7) | (1 << 3)));
 
 		/*
-		 * 3. DMC1 refresh count for 133Mhz if (index == L4) is
-		 * true refresh counter is already programed in upper
-		 * code. 0x287@83Mhz
+		 * 3. DMC1 refresh count for the MPLL detour is already
+		 * programmed above.
 		 */
-		if (!bus_speed_changing)
-			s5pv210_set_refresh(DMC1, 133000);
 
 		/* 4. SCLKAPLL -> SCLKMPLL */
 		reg = __raw_readl(S5P_CLK_SRC0);
@@ -420,14 +466,14 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		S5P_CLKDIV0_HCLK166_MASK | S5P_CLKDIV0_PCLK83_MASK |
 		S5P_CLKDIV0_HCLK133_MASK | S5P_CLKDIV0_PCLK66_MASK);
 
-	reg |= ((clkdiv_val[index][0] << S5P_CLKDIV0_APLL_SHIFT) |
-		(clkdiv_val[index][1] << S5P_CLKDIV0_A2M_SHIFT) |
-		(clkdiv_val[index][2] << S5P_CLKDIV0_HCLK200_SHIFT) |
-		(clkdiv_val[index][3] << S5P_CLKDIV0_PCLK100_SHIFT) |
-		(clkdiv_val[index][4] << S5P_CLKDIV0_HCLK166_SHIFT) |
-		(clkdiv_val[index][5] << S5P_CLKDIV0_PCLK83_SHIFT) |
-		(clkdiv_val[index][6] << S5P_CLKDIV0_HCLK133_SHIFT) |
-		(clkdiv_val[index][7] << S5P_CLKDIV0_PCLK66_SHIFT));
+	reg |= ((div[DIV_APLL] << S5P_CLKDIV0_APLL_SHIFT) |
+		(div[DIV_A2M] << S5P_CLKDIV0_A2M_SHIFT) |
+		(div[DIV_HCLK_MSYS] << S5P_CLKDIV0_HCLK200_SHIFT) |
+		(div[DIV_PCLK_MSYS] << S5P_CLKDIV0_PCLK100_SHIFT) |
+		(div[DIV_HCLK_DSYS] << S5P_CLKDIV0_HCLK166_SHIFT) |
+		(div[DIV_PCLK_DSYS] << S5P_CLKDIV0_PCLK83_SHIFT) |
+		(div[DIV_HCLK_PSYS] << S5P_CLKDIV0_HCLK133_SHIFT) |
+		(div[DIV_PCLK_PSYS] << S5P_CLKDIV0_PCLK66_SHIFT));
 
 	__raw_writel(reg, S5P_CLK_DIV0);
 
@@ -438,11 +484,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 	/* ARM MCS value changed */
 	reg = __raw_readl(S5P_ARM_MCS_CON);
 	reg &= ~0x3;
-	if (index >= L3)
-		reg |= 0x3;
-	else
-		reg |= 0x1;
-
+	reg |= lvl->mcs;
 	__raw_writel(reg, S5P_ARM_MCS_CON);
 
 	if (pll_changing) {
@@ -454,17 +496,7 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 * 6-1. Set PMS values
 		 * 6-2. Wait untile the PLL is locked
 		 */
-		switch (index) {
-		case OC0:
-			__raw_writel(APLL_VAL_1200, S5P_APLL_CON);
-			break;
-		case L0:
-			__raw_writel(APLL_VAL_1000, S5P_APLL_CON);
-			break;
-		default:
-			__raw_writel(APLL_VAL_800, S5P_APLL_CON);
-			break;
-		}
+		__raw_writel(lvl->apll, S5P_APLL_CON);
 
 		do {
 			reg = __raw_readl(S5P_APLL_CON);
@@ -491,8 +523,8 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		 */
 		reg = __raw_readl(S5P_CLK_DIV2);
 		reg &= ~(S5P_CLKDIV2_G3D_MASK | S5P_CLKDIV2_MFC_MASK);
-		reg |= (clkdiv_val[index][10] << S5P_CLKDIV2_G3D_SHIFT) |
-			(clkdiv_val[index][9] << S5P_CLKDIV2_MFC_SHIFT);
+		reg |= (div[DIV_G3D] << S5P_CLKDIV2_G3D_SHIFT) |
+			(div[DIV_MFC] << S5P_CLKDIV2_MFC_SHIFT);
 		__raw_writel(reg, S5P_CLK_DIV2);
 
 		/* For MFC, G3D dividing */
@@ -509,48 +541,100 @@ static int s5pv210_target(struct cpufreq_policy *policy,
 		do {
 			reg = __raw_readl(S5P_CLKMUX_STAT0);
 		} while (reg & (0x1 << 18));
-
-		/*
-		 * 10. DMC1 refresh counter
-		 * L4 : DMC1 = 100Mhz 7.8us/(1/100) = 0x30c
-		 * Others : DMC1 = 200Mhz 7.8us/(1/200) = 0x618
-		 */
-		if (!bus_speed_changing)
-			s5pv210_set_refresh(DMC1, 200000);
 	}
 
 	/*
-	 * L4 level need to change memory bus speed, hence onedram clock divier
-	 * and memory refresh parameter should be changed
+	 * Scaling DMC0 needs to change the onedram clock divider and
+	 * memory refresh parameter
 	 */
 	if (bus_speed_changing) {
 		reg = __raw_readl(S5P_CLK_DIV6);
 		reg &= ~S5P_CLKDIV6_ONEDRAM_MASK;
-		reg |= (clkdiv_val[index][8] << S5P_CLKDIV6_ONEDRAM_SHIFT);
+		reg |= (div[DIV_ONEDRAM] << S5P_CLKDIV6_ONEDRAM_SHIFT);
 		__raw_writel(reg, S5P_CLK_DIV6);
 
 		do {
 			reg = __raw_readl(S5P_CLKDIV_STAT1);
 		} while (reg & (1 << 15));
 
-		/* Reconfigure DRAM refresh counter value */
-		if (index != L4) {
-			/*
-			 * DMC0 : 166Mhz
-			 * DMC1 : 200Mhz
-			 */
-			s5pv210_set_refresh(DMC0, 166000);
-			s5pv210_set_refresh(DMC1, 200000);
-		} else {
-			/*
-			 * DMC0 : 83Mhz
-			 * DMC1 : 100Mhz
-			 */
-			s5pv210_set_refresh(DMC0, 83000);
-			s5pv210_set_refresh(DMC1, 100000);
+		s5pv210_set_refresh(DMC0, dmc0_new);
+	}
+
+	/* 10. DMC1 refresh counter for its final clock */
+	s5pv210_set_refresh(DMC1, dmc1_new);
+
+	cur_level = index;
+	bus_low = low;
+}
+
+static int s5pv210_target(struct cpufreq_policy *policy,
+			  unsigned int target_freq,
+			  unsigned int relation)
+{
+	unsigned int index;
+	unsigned int arm_volt, int_volt;
+	bool low;
+	int ret = 0;
+
+	mutex_lock(&set_freq_lock);
+
+	if (relation & ENABLE_FURTHER_CPUFREQ)
+		no_cpufreq_access = false;
+	if (no_cpufreq_access) {
+#ifdef CONFIG_PM_VERBOSE
+		pr_err("%s:%d denied access to %s as it is disabled"
+				"temporarily\n", __FILE__, __LINE__, __func__);
+#endif
+		ret = -EINVAL;
+		goto out;
+	}
+	if (relation & DISABLE_FURTHER_CPUFREQ)
+		no_cpufreq_access = true;
+	relation &= ~(ENABLE_FURTHER_CPUFREQ | DISABLE_FURTHER_CPUFREQ);
+
+	freqs.old = s5pv210_getspeed(0);
+
+	if (cpufreq_frequency_table_target(policy, s5pv210_freq_table,
+					   target_freq, relation, &index)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	index = s5pv210_qos_index(index);
+	low = bus_low && s5pv210_bus_low_allowed(index);
+
+	freqs.new = s5pv210_levels[index].freq;
+	freqs.cpu = 0;
+
+	if (freqs.new == freqs.old) {
+		/* a raised DMC minimum can still need the bus back up */
+		if (low != bus_low)
+			s5pv210_set_level(index, low);
+		goto out;
+	}
+
+	arm_volt = s5pv210_levels[index].arm_volt;
+	int_volt = s5pv210_levels[index].int_volt;
+
+	if (freqs.new > freqs.old) {
+		/* Voltage up code: increase ARM first */
+		if (!IS_ERR_OR_NULL(arm_regulator) &&
+				!IS_ERR_OR_NULL(internal_regulator)) {
+			ret = regulator_set_voltage(arm_regulator,
+						    arm_volt, arm_volt_max);
+			if (ret)
+				goto out;
+			ret = regulator_set_voltage(internal_regulator,
+						    int_volt, int_volt_max);
+			if (ret)
+				goto out;
 		}
 	}
 
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+
+	s5pv210_set_level(index, low);
+
 	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
 
 	if (freqs.new < freqs.old) {
@@ -570,6 +654,83 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_HW_PERF_EVENTS
+/*
+ * The DMCs have no usage counters. Memory demand is estimated from the
+ * L2 read misses counted by the ARM PMU, each of which costs a 64 byte
+ * line fill from DRAM. Traffic from the other bus masters is not seen
+ * here, so drivers that stream through memory on their own hold a
+ * PM_QOS_BUS_DMC_MIN request instead.
+ */
+#define BUS_SAMPLE_MS		100
+#define BUS_UP_MBPS		300	/* back to full speed above this */
+#define BUS_DOWN_MBPS		150	/* scale down below this */
+#define L2_LINE_SIZE		64
+
+static struct perf_event *l2_miss_event;
+static u64 l2_miss_last;
+static unsigned long bus_sample_last;
+static struct delayed_work bus_work;
+
+static struct perf_event_attr l2_miss_attr = {
+	.type		= PERF_TYPE_HW_CACHE,
+	.config		= PERF_COUNT_HW_CACHE_LL |
+			  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	.size		= sizeof(struct perf_event_attr),
+	.pinned		= 1,
+};
+
+static void s5pv210_bus_work(struct work_struct *work)
+{
+	u64 enabled, running, count, bytes;
+	unsigned int ms;
+	bool low;
+
+	count = perf_event_read_value(l2_miss_event, &enabled, &running);
+	ms = jiffies_to_msecs(jiffies - bus_sample_last);
+	bus_sample_last = jiffies;
+	bytes = (count - l2_miss_last) * L2_LINE_SIZE;
+	l2_miss_last = count;
+
+	if (ms) {
+		/* bytes per ms / 1000 is MB/s */
+		do_div(bytes, ms * 1000);
+		low = bus_low ? bytes < BUS_UP_MBPS : bytes < BUS_DOWN_MBPS;
+		mutex_lock(&set_freq_lock);
+		if (low && cur_level >= 0 && !s5pv210_bus_low_allowed(cur_level))
+			low = false;
+		if (low != bus_low && cur_level >= 0 && !no_cpufreq_access) {
+			s5pv210_set_level(cur_level, low);
+			pr_debug("Memory bus %s at %llu MB/s\n",
+				 low ? "scaled down" : "at full speed", bytes);
+		}
+		mutex_unlock(&set_freq_lock);
+	}
+
+	schedule_delayed_work(&bus_work, msecs_to_jiffies(BUS_SAMPLE_MS));
+}
+
+static void __init s5pv210_bus_monitor_init(void)
+{
+	l2_miss_event = perf_event_create_kernel_counter(&l2_miss_attr, 0,
+							 NULL, NULL);
+	if (IS_ERR(l2_miss_event)) {
+		pr_info("%s: no L2 miss counter, memory bus stays at full "
+			"speed\n", __func__);
+		return;
+	}
+
+	bus_sample_last = jiffies;
+	INIT_DELAYED_WORK_DEFERRABLE(&bus_work, s5pv210_bus_work);
+	schedule_delayed_work(&bus_work, msecs_to_jiffies(BUS_SAMPLE_MS));
+}
+#else
+static inline void s5pv210_bus_monitor_init(void)
+{
+}
+#endif
+
 #ifdef CONFIG_PM
 static int s5pv210_cpufreq_suspend(struct cpufreq_policy *policy)
 {
@@ -641,12 +802,6 @@ static int __init s5pv210_cpu_init(struct cpufreq_policy *policy)
 
 	policy->cpuinfo.transition_latency = 40000;
 
-#ifdef CONFIG_DVFS_LIMIT
-	int i;
-	for (i = 0; i < DVFS_LOCK_TOKEN_NUM; i++)
-		g_dvfslockval[i] = MAX_PERF_LEVEL;
-#endif
-
 	/* Set max freq to 1GHz on startup */
 	ret = cpufreq_frequency_table_cpuinfo(policy, s5pv210_freq_table);
 	policy->min = 400000;
@@ -689,6 +844,22 @@ static int s5pv210_cpufreq_reboot_notifier_event(struct notifier_block *this,
 	return NOTIFY_DONE;
 }
 
+/* Reapply the current speed so the new QoS targets take effect */
+static int s5pv210_cpufreq_qos_notifier_event(struct notifier_block *this,
+		unsigned long value, void *ptr)
+{
+	struct cpufreq_policy *policy;
+
+	policy = cpufreq_cpu_get(0);
+	if (!policy)
+		return NOTIFY_DONE;
+
+	cpufreq_driver_target(policy, policy->cur, CPUFREQ_RELATION_L);
+	cpufreq_cpu_put(policy);
+
+	return NOTIFY_OK;
+}
+
 static struct freq_attr *s5pv210_cpufreq_attr[] = {
 	&cpufreq_freq_attr_scaling_available_freqs,
 	NULL,
@@ -716,21 +887,25 @@ static struct notifier_block s5pv210_cpufreq_reboot_notifier = {
 	.notifier_call	= s5pv210_cpufreq_reboot_notifier_event,
 };
 
+static struct notifier_block s5pv210_cpufreq_qos_notifier[] = {
+	{ .notifier_call = s5pv210_cpufreq_qos_notifier_event, },
+	{ .notifier_call = s5pv210_cpufreq_qos_notifier_event, },
+	{ .notifier_call = s5pv210_cpufreq_qos_notifier_event, },
+};
+
 static int __init s5pv210_cpufreq_probe(struct platform_device *pdev)
 {
 	struct s5pv210_cpufreq_data *pdata = dev_get_platdata(&pdev->dev);
-	int i, j;
+	int i, j, ret;
 
 	if (pdata && pdata->size) {
 		for (i = 0; i < pdata->size; i++) {
-			j = 0;
-			while (s5pv210_freq_table[j].frequency != CPUFREQ_TABLE_END) {
-				if (s5pv210_freq_table[j].frequency == pdata->volt[i].freq) {
-					dvs_conf[j].arm_volt = pdata->volt[i].varm;
-					dvs_conf[j].int_volt = pdata->volt[i].vint;
+			for (j = 0; j <= MAX_PERF_LEVEL; j++) {
+				if (s5pv210_levels[j].freq == pdata->volt[i].freq) {
+					s5pv210_levels[j].arm_volt = pdata->volt[i].varm;
+					s5pv210_levels[j].int_volt = pdata->volt[i].vint;
 					break;
 				}
-				j++;
 			}
 		}
 	}
@@ -750,10 +925,38 @@ error:
 	pr_warn("Cannot get vddarm or vddint. CPUFREQ Will not"
 		       " change the voltage.\n");
 finish:
+	for (i = 0; i <= MAX_PERF_LEVEL; i++) {
+		struct s5pv210_freq_level *lvl = &s5pv210_levels[i];
+
+		s5pv210_freq_table[i].index = i;
+		s5pv210_freq_table[i].frequency = lvl->freq;
+		if (!s5pv210_volt_supported(arm_regulator, lvl->arm_volt) ||
+		    !s5pv210_volt_supported(internal_regulator,
+					    lvl->int_volt)) {
+			pr_warn("%s: %u kHz needs %lu/%lu uV which the "
+				"regulators cannot set, level disabled\n",
+				__func__, lvl->freq, lvl->arm_volt,
+				lvl->int_volt);
+			s5pv210_freq_table[i].frequency = CPUFREQ_ENTRY_INVALID;
+		}
+	}
+	s5pv210_freq_table[i].index = 0;
+	s5pv210_freq_table[i].frequency = CPUFREQ_TABLE_END;
+
+	s5pv210_bus_monitor_init();
+
 	register_pm_notifier(&s5pv210_cpufreq_notifier);
 	register_reboot_notifier(&s5pv210_cpufreq_reboot_notifier);
 
-	return cpufreq_register_driver(&s5pv210_driver);
+	ret = cpufreq_register_driver(&s5pv210_driver);
+	if (ret)
+		return ret;
+
+	pm_qos_add_notifier(PM_QOS_CPU_FREQ_MIN, &s5pv210_cpufreq_qos_notifier[0]);
+	pm_qos_add_notifier(PM_QOS_CPU_FREQ_MAX, &s5pv210_cpufreq_qos_notifier[1]);
+	pm_qos_add_notifier(PM_QOS_BUS_DMC_MIN, &s5pv210_cpufreq_qos_notifier[2]);
+
+	return 0;
 }
 
 static struct platform_driver s5pv210_cpufreq_drv = {
@@ -777,11 +980,21 @@ static int __init s5pv210_cpufreq_init(void)
 
 late_initcall(s5pv210_cpufreq_init);
 
+/*
+ * UV_mV_table is positional. Keep the positions the six original levels
+ * always had and append the levels added later at the end, so existing
+ * userspace keeps setting the voltages it means to.
+ */
+static const int uv_mv_levels[MAX_PERF_LEVEL + 1] = {
+	OC0, L0, L1, L2, L3, L4, L1_1, L2_1,
+};
+
 ssize_t show_UV_mV_table(struct cpufreq_policy *policy, char *buf)
 {
-	int i, len = 0;
+	int i, l, len = 0;
 	for (i = 0; i <= MAX_PERF_LEVEL; i++) {
-		len += sprintf(buf + len, "%dmhz: %d mV\n", s5pv210_freq_table[i].frequency / 1000, dvs_conf[i].arm_volt / 1000);
+		l = uv_mv_levels[i];
+		len += sprintf(buf + len, "%umhz: %lu mV\n", s5pv210_levels[l].freq / 1000, s5pv210_levels[l].arm_volt / 1000);
 	}
 	return len;
 }
@@ -806,12 +1019,22 @@ ssize_t store_UV_mV_table(struct cpufreq_policy *policy,
 		}
 	}
 
+	mutex_lock(&set_freq_lock);
 	for (i = 0; i < j; i++) {
+		int l = uv_mv_levels[i];
+
 		if (u[i] > arm_volt_max / 1000) {
 			u[i] = arm_volt_max / 1000;
 		}
-		dvs_conf[i].arm_volt = u[i] * 1000;
+		/* keep the old value rather than let the regulator round up */
+		if (!s5pv210_volt_supported(arm_regulator, u[i] * 1000)) {
+			pr_warn("%s: %d mV not supported for %u kHz\n",
+				__func__, u[i], s5pv210_levels[l].freq);
+			continue;
+		}
+		s5pv210_levels[l].arm_volt = u[i] * 1000;
 	}
+	mutex_unlock(&set_freq_lock);
 
 	return count;
 }
@@ -12,22 +12,132 @@
 
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/cpuidle.h>
+#include <linux/cpu.h>
+#include <linux/sysdev.h>
 #include <linux/io.h>
+#include <linux/dma-mapping.h>
 #include <asm/proc-fns.h>
 #include <asm/cacheflush.h>
+#include <asm/system.h>
+#include <asm/hardware/vic.h>
 
 #include <mach/map.h>
 #include <mach/regs-irq.h>
 #include <mach/regs-clock.h>
+#include <mach/power-domain.h>
+#include <mach/cpuidle.h>
 #include <plat/pm.h>
 #include <plat/devs.h>
 
 #include <mach/dma.h>
 #include <mach/regs-gpio.h>
 
-#define S5PC110_MAX_STATES	1
+/*
+ * IDLE      - ARM clock gated by WFI
+ * DIDLE     - deep idle, ARM and L2 logic powered off, top block on
+ * DIDLE_RET - deep idle with the top block logic and memories in
+ *             retention, only allowed while every power domain is off
+ *
+ * Both deep states come back through the iROM and the bootloader,
+ * which jumps to s5pv210_didle_resume. The exit latencies below cover
+ * that path; the residencies also pay for the L1/L2 clean on the way in.
+ *
+ * The deep state numbers have not been measured on hardware yet. They are
+ * upper estimates: the ARM block power up and the iROM and bootloader
+ * rerun come to a few hundred uS, plus the context restore. Retention adds
+ * the top block wakeup. The residencies are set at about twenty times the
+ * exit latency, so the cache clean and the lost L2 contents pay off. Use
+ * numbers measured with a GPIO toggled around s5p_enter_didle() instead
+ * once they are available.
+ */
+enum {
+	S5P_IDLE_WFI,
+	S5P_IDLE_DIDLE,
+	S5P_IDLE_DIDLE_RET,
+	S5PC110_MAX_STATES,
+};
+
+static struct {
+	const char	*name;
+	const char	*desc;
+	unsigned int	exit_latency;		/* uS */
+	unsigned int	target_residency;	/* uS */
+} s5p_idle_states[S5PC110_MAX_STATES] = {
+	[S5P_IDLE_WFI] = {
+		.name			= "IDLE",
+		.desc			= "ARM clock gating - WFI",
+		.exit_latency		= 1,
+		.target_residency	= 1,
+	},
+	[S5P_IDLE_DIDLE] = {
+		.name			= "DIDLE",
+		.desc			= "ARM power gating - top block on",
+		.exit_latency		= 300,
+		.target_residency	= 5000,
+	},
+	[S5P_IDLE_DIDLE_RET] = {
+		.name			= "DIDLE-RET",
+		.desc			= "ARM power gating - top block retention",
+		.exit_latency		= 500,
+		.target_residency	= 10000,
+	},
+};
+
+/* Deepest state the governor may pick, for bring-up and debugging */
+static int deepest_state = S5PC110_MAX_STATES - 1;
+module_param(deepest_state, int, 0644);
+
+/* Reasons a deep state was ruled out for an idle period */
+enum {
+	S5P_IDLE_BUSY_DMA,
+	S5P_IDLE_BUSY_MMC,
+	S5P_IDLE_BUSY_ONENAND,
+	S5P_IDLE_BUSY_AUDIO,
+	S5P_IDLE_BUSY_DOMAIN,
+	S5P_IDLE_BUSY_MAX,
+};
+
+static const char *s5p_idle_busy_names[S5P_IDLE_BUSY_MAX] = {
+	[S5P_IDLE_BUSY_DMA]	= "dma",
+	[S5P_IDLE_BUSY_MMC]	= "mmc",
+	[S5P_IDLE_BUSY_ONENAND]	= "onenand",
+	[S5P_IDLE_BUSY_AUDIO]	= "audio",
+	[S5P_IDLE_BUSY_DOMAIN]	= "domain",
+};
+
+static struct {
+	unsigned long	busy[S5P_IDLE_BUSY_MAX];
+	unsigned long	demoted[S5PC110_MAX_STATES];
+	unsigned long	aborted[S5PC110_MAX_STATES];
+} s5p_idle_stats;
+
+#define S5P_HSMMC_CH		4
+#define S5P_HSMMC_PRNSTS	0x24
+#define S5P_HSMMC_INHIBIT	(0x3 << 0)	/* command and data lines */
+
+#define S5P_ONENAND_DMA_STATUS	0x41c
+#define S5P_ONENAND_DMA_BUSY	(0x1 << 17)
+
+#define S5P_IISCON		0x00
+#define S5P_IISCON_ACTIVE	(0x1 << 0)
+
+static void __iomem *s5p_idle_hsmmc_base[S5P_HSMMC_CH];
+static void __iomem *s5p_idle_onenand_dma_base;
+static void __iomem *s5p_idle_i2s_base;
+
+/*
+ * CP15 state saved by s5pv210_didle_save, r3 - r13.  The resume path
+ * reads it with the MMU and caches off, while the L2 keeps its contents
+ * in retention, so it lives in uncached memory.
+ */
+#define S5P_DIDLE_REGS_SIZE	(11 * sizeof(unsigned long))
+static unsigned long *s5p_didle_regs;
+
+/* Physical address of s5p_didle_regs, picked up by the resume path */
+unsigned long s5pv210_didle_regs_phys;
 
 static void s5p_enter_idle(void)
 {
@@ -45,17 +155,193 @@ static void s5p_enter_idle(void)
 	cpu_do_idle();
 }
 
+/*
+ * Registers of a clock gated block must not be touched, so every check
+ * looks at the gate first and treats a gated block as idle.
+ */
+static int s5p_idle_dma_busy(void)
+{
+	return __raw_readl(S5P_CLKGATE_IP0) & (S5P_CLKGATE_IP0_PDMA0 |
+			S5P_CLKGATE_IP0_PDMA1 | S5P_CLKGATE_IP0_MDMA);
+}
+
+static int s5p_idle_mmc_busy(void)
+{
+	unsigned long gate = __raw_readl(S5P_CLKGATE_IP2);
+	int ch;
+
+	for (ch = 0; ch < S5P_HSMMC_CH; ch++) {
+		if (!s5p_idle_hsmmc_base[ch] ||
+		    !(gate & (S5P_CLKGATE_IP2_HSMMC0 << ch)))
+			continue;
+
+		if (__raw_readl(s5p_idle_hsmmc_base[ch] + S5P_HSMMC_PRNSTS) &
+				S5P_HSMMC_INHIBIT)
+			return 1;
+	}
+
+	return 0;
+}
+
+static int s5p_idle_onenand_busy(void)
+{
+	if (!s5p_idle_onenand_dma_base ||
+	    !(__raw_readl(S5P_CLKGATE_IP1) & S5P_CLKGATE_IP1_NANDXL))
+		return 0;
+
+	return __raw_readl(s5p_idle_onenand_dma_base +
+			S5P_ONENAND_DMA_STATUS) & S5P_ONENAND_DMA_BUSY;
+}
+
+/* I2S0 sits in the audio domain and reads as garbage while it is off */
+static int s5p_idle_audio_busy(void)
+{
+	if (!s5p_idle_i2s_base ||
+	    !(__raw_readl(S5P_NORMAL_CFG) & S5PV210_PD_AUDIO))
+		return 0;
+
+	return __raw_readl(s5p_idle_i2s_base + S5P_IISCON) &
+			S5P_IISCON_ACTIVE;
+}
+
+static int s5p_idle_domain_on(void)
+{
+	return __raw_readl(S5P_NORMAL_CFG) & (S5PV210_PD_LCD |
+			S5PV210_PD_CAM | S5PV210_PD_TV | S5PV210_PD_MFC |
+			S5PV210_PD_G3D | S5PV210_PD_AUDIO);
+}
+
+/* Deepest state the hardware allows right now */
+static int s5p_idle_allowed_state(void)
+{
+	int busy = -1;
+
+	if (s5p_idle_dma_busy())
+		busy = S5P_IDLE_BUSY_DMA;
+	else if (s5p_idle_mmc_busy())
+		busy = S5P_IDLE_BUSY_MMC;
+	else if (s5p_idle_onenand_busy())
+		busy = S5P_IDLE_BUSY_ONENAND;
+	else if (s5p_idle_audio_busy())
+		busy = S5P_IDLE_BUSY_AUDIO;
+
+	if (busy >= 0) {
+		s5p_idle_stats.busy[busy]++;
+		return S5P_IDLE_WFI;
+	}
+
+	if (s5p_idle_domain_on()) {
+		s5p_idle_stats.busy[S5P_IDLE_BUSY_DOMAIN]++;
+		return S5P_IDLE_DIDLE;
+	}
+
+	return S5P_IDLE_DIDLE_RET;
+}
+
+static int s5p_idle_limit(void)
+{
+	int limit = deepest_state;
+
+	if (limit < S5P_IDLE_WFI)
+		limit = S5P_IDLE_WFI;
+	if (limit > S5P_IDLE_DIDLE_RET)
+		limit = S5P_IDLE_DIDLE_RET;
+
+	if (limit > S5P_IDLE_WFI)
+		limit = min(limit, s5p_idle_allowed_state());
+
+	return limit;
+}
+
+/*
+ * Power the ARM core down. Returns 0 if a pending interrupt made the
+ * wfi fall through, in which case no state was lost.
+ */
+static int s5p_enter_didle(int top_ret)
+{
+	unsigned long tmp, wakeup_mask, others;
+	int ret;
+
+	/* The Bada bootloader resumes through INFORM2, see pm.c */
+	__raw_writel(virt_to_phys(s5pv210_didle_resume), S5P_INFORM2);
+
+	wakeup_mask = __raw_readl(S5P_WAKEUP_MASK);
+	__raw_writel(wakeup_mask & ~0xffff, S5P_WAKEUP_MASK);
+
+	tmp = __raw_readl(S5P_WAKEUP_STAT);
+	__raw_writel(tmp, S5P_WAKEUP_STAT);
+
+	tmp = __raw_readl(S5P_IDLE_CFG);
+	tmp &= ~(S5P_IDLE_CFG_TL_MASK | S5P_IDLE_CFG_TM_MASK |
+		 S5P_IDLE_CFG_L2_MASK | S5P_IDLE_CFG_DIDLE);
+	if (top_ret)
+		tmp |= S5P_IDLE_CFG_TL_RET | S5P_IDLE_CFG_TM_RET;
+	else
+		tmp |= S5P_IDLE_CFG_TL_ON | S5P_IDLE_CFG_TM_ON;
+	tmp |= S5P_IDLE_CFG_L2_RET | S5P_IDLE_CFG_DIDLE;
+	__raw_writel(tmp, S5P_IDLE_CFG);
+
+	tmp = __raw_readl(S5P_PWR_CFG);
+	tmp &= S5P_CFG_WFI_CLEAN;
+	tmp |= S5P_CFG_WFI_IDLE;
+	__raw_writel(tmp, S5P_PWR_CFG);
+
+	others = __raw_readl(S5P_OTHERS);
+	__raw_writel(others | S5P_OTHER_SYSC_INTOFF, S5P_OTHERS);
+
+#ifdef CONFIG_VFP
+	vfp_pm_save_context();
+#endif
+
+	ret = s5pv210_didle_save(s5p_didle_regs);
+
+	/* The banked stacks of the exception modes did not survive */
+	if (ret)
+		cpu_init();
+
+#ifdef CONFIG_VFP
+	vfp_pm_restore_context();
+#endif
+
+	/* Release the IO retention taken on the way down */
+	others |= S5P_OTHERS_RET_IO | S5P_OTHERS_RET_CF |
+		  S5P_OTHERS_RET_MMC | S5P_OTHERS_RET_UART;
+	__raw_writel(others, S5P_OTHERS);
+
+	tmp = __raw_readl(S5P_IDLE_CFG);
+	tmp &= ~(S5P_IDLE_CFG_L2_MASK | S5P_IDLE_CFG_DIDLE);
+	__raw_writel(tmp, S5P_IDLE_CFG);
+
+	__raw_writel(wakeup_mask, S5P_WAKEUP_MASK);
+
+	return ret;
+}
+
 /* Actual code that puts the SoC in different idle states */
-static int s5p_enter_idle_normal(struct cpuidle_device *dev,
+static int s5p_enter_idle_state(struct cpuidle_device *dev,
 				struct cpuidle_state *state)
 {
 	struct timeval before, after;
-	int idle_time;
+	int idx = (int)cpuidle_get_statedata(state);
+	int allowed, idle_time;
 
 	local_irq_disable();
 	do_gettimeofday(&before);
 
-	s5p_enter_idle();
+	/* Something may have started between ->prepare and now */
+	if (idx > S5P_IDLE_WFI) {
+		allowed = s5p_idle_limit();
+		if (idx > allowed) {
+			s5p_idle_stats.demoted[idx]++;
+			idx = allowed;
+			dev->last_state = &dev->states[idx];
+		}
+	}
+
+	if (idx == S5P_IDLE_WFI)
+		s5p_enter_idle();
+	else if (!s5p_enter_didle(idx == S5P_IDLE_DIDLE_RET))
+		s5p_idle_stats.aborted[idx]++;
 
 	do_gettimeofday(&after);
 	local_irq_enable();
@@ -64,6 +350,22 @@ static int s5p_enter_idle_normal(struct cpuidle_device *dev,
 	return idle_time;
 }
 
+/* Hide the states the busy checks rule out from the governor */
+static int s5p_idle_prepare(struct cpuidle_device *dev)
+{
+	int limit = s5p_idle_limit();
+	int i;
+
+	for (i = S5P_IDLE_WFI + 1; i < dev->state_count; i++) {
+		if (i > limit)
+			dev->states[i].flags |= CPUIDLE_FLAG_IGNORE;
+		else
+			dev->states[i].flags &= ~CPUIDLE_FLAG_IGNORE;
+	}
+
+	return 0;
+}
+
 static DEFINE_PER_CPU(struct cpuidle_device, s5p_cpuidle_device);
 
 static struct cpuidle_driver s5p_idle_driver = {
@@ -71,29 +373,94 @@ static struct cpuidle_driver s5p_idle_driver = {
 	.owner =        THIS_MODULE,
 };
 
+/*
+ * Per state usage and time live in the cpuidle core's sysfs; this adds
+ * why the deep states were passed over.
+ */
+static ssize_t s5p_idle_stats_show(struct sysdev_class *class,
+			struct sysdev_class_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int i;
+
+	len += sprintf(buf + len, "%-10s %10s %10s\n",
+			"state", "demoted", "aborted");
+	for (i = 0; i < S5PC110_MAX_STATES; i++)
+		len += sprintf(buf + len, "%-10s %10lu %10lu\n",
+				s5p_idle_states[i].name,
+				s5p_idle_stats.demoted[i],
+				s5p_idle_stats.aborted[i]);
+
+	len += sprintf(buf + len, "\n%-10s %10s\n", "busy", "count");
+	for (i = 0; i < S5P_IDLE_BUSY_MAX; i++)
+		len += sprintf(buf + len, "%-10s %10lu\n",
+				s5p_idle_busy_names[i],
+				s5p_idle_stats.busy[i]);
+
+	return len;
+}
+
+static SYSDEV_CLASS_ATTR(s5p_idle_stats, 0444, s5p_idle_stats_show, NULL);
+
+static void __init s5p_idle_map_regs(void)
+{
+	int ch;
+
+	for (ch = 0; ch < S5P_HSMMC_CH; ch++)
+		s5p_idle_hsmmc_base[ch] = ioremap(S5PV210_PA_HSMMC(ch), SZ_4K);
+
+	s5p_idle_onenand_dma_base = ioremap(S5P_PA_ONENAND_DMA, SZ_4K);
+	s5p_idle_i2s_base = ioremap(S5PV210_PA_IIS0, SZ_4K);
+}
+
 /* Initialize CPU idle by registering the idle states */
 static int s5p_init_cpuidle(void)
 {
 	struct cpuidle_device *device;
+	dma_addr_t didle_regs_dma;
+	int i;
+
+	s5p_idle_map_regs();
+
+	s5p_didle_regs = dma_alloc_coherent(NULL, S5P_DIDLE_REGS_SIZE,
+					    &didle_regs_dma, GFP_KERNEL);
+	if (!s5p_didle_regs)
+		return -ENOMEM;
+
+	/* Written once, but read by the resume path from DRAM as well */
+	s5pv210_didle_regs_phys = didle_regs_dma;
+	__cpuc_flush_dcache_area(&s5pv210_didle_regs_phys,
+				 sizeof(s5pv210_didle_regs_phys));
+	outer_clean_range(__pa(&s5pv210_didle_regs_phys),
+			  __pa(&s5pv210_didle_regs_phys + 1));
 
 	cpuidle_register_driver(&s5p_idle_driver);
 
 	device = &per_cpu(s5p_cpuidle_device, smp_processor_id());
-	device->state_count = 1;
+	device->state_count = S5PC110_MAX_STATES;
+	device->prepare = s5p_idle_prepare;
 
-	/* Wait for interrupt state */
-	device->states[0].enter = s5p_enter_idle_normal;
-	device->states[0].exit_latency = 1;	/* uS */
-	device->states[0].target_residency = 10000;
-	device->states[0].flags = CPUIDLE_FLAG_TIME_VALID;
-	strcpy(device->states[0].name, "IDLE");
-	strcpy(device->states[0].desc, "ARM clock gating - WFI");
+	for (i = 0; i < S5PC110_MAX_STATES; i++) {
+		struct cpuidle_state *state = &device->states[i];
+
+		state->enter = s5p_enter_idle_state;
+		state->exit_latency = s5p_idle_states[i].exit_latency;
+		state->target_residency = s5p_idle_states[i].target_residency;
+		state->flags = CPUIDLE_FLAG_TIME_VALID;
+		strcpy(state->name, s5p_idle_states[i].name);
+		strcpy(state->desc, s5p_idle_states[i].desc);
+		cpuidle_set_statedata(state, (void *)i);
+	}
 
 	if (cpuidle_register_device(device)) {
 		printk(KERN_ERR "s5p_init_cpuidle: Failed registering\n");
 		return -EIO;
 	}
 
+	if (sysdev_class_create_file(&cpu_sysdev_class,
+				&attr_s5p_idle_stats))
+		printk(KERN_WARNING "s5p_init_cpuidle: no stats file\n");
+
 	return 0;
 }
 
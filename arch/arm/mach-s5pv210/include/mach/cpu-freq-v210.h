@@ -15,7 +15,15 @@
 #include <linux/cpufreq.h>
 
 enum perf_level {
-	OC0, L0, L1, L2, L3, L4, MAX_PERF_LEVEL = L4,
+	OC0,	/* 1200MHz */
+	L0,	/* 1000MHz */
+	L1,	/* 800MHz */
+	L1_1,	/* 600MHz */
+	L2,	/* 400MHz */
+	L2_1,	/* 300MHz */
+	L3,	/* 200MHz */
+	L4,	/* 100MHz */
+	MAX_PERF_LEVEL = L4,
 };
 
 /* For cpu-freq driver */
@@ -30,24 +38,6 @@ struct s5pv210_cpufreq_data {
 	unsigned int			size;
 };
 
-#ifdef CONFIG_DVFS_LIMIT
-enum {
-	DVFS_LOCK_TOKEN_1 = 0,	// MFC
-	DVFS_LOCK_TOKEN_2,	//	(FIMC)
-	DVFS_LOCK_TOKEN_3,	// SND_RP
-	DVFS_LOCK_TOKEN_4,	//	(TV)
-	DVFS_LOCK_TOKEN_5,	//	(early suspend)
-	DVFS_LOCK_TOKEN_6,	// APPS by sysfs
-	DVFS_LOCK_TOKEN_7,	// 	(TOUCH)
-	DVFS_LOCK_TOKEN_8,	// USB
-	DVFS_LOCK_TOKEN_9,	// BT
-	DVFS_LOCK_TOKEN_NUM
-};
-
-extern void s5pv210_lock_dvfs_high_level(uint nToken, uint perf_level);
-extern void s5pv210_unlock_dvfs_high_level(unsigned int nToken);
-#endif
-
 extern void s5pv210_cpufreq_set_platdata(struct s5pv210_cpufreq_data *pdata);
 
 #endif /* __ASM_ARCH_CPU_FREQ_H */
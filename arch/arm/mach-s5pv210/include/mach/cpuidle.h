@@ -12,5 +12,6 @@
 
 extern int  s5pv210_didle_save(unsigned long *saveblk);
 extern void s5pv210_didle_resume(void);
+extern unsigned long s5pv210_didle_regs_phys;
 extern void i2sdma_getpos(dma_addr_t *src);
 extern unsigned int get_rtc_cnt(void);
@@ -453,10 +453,18 @@ static struct s5pv210_cpufreq_voltage smdkc110_cpufreq_volt[] = {
 		.freq	=  800000,
 		.varm	= 1200000,
 		.vint	= 1100000,
+	}, {
+		.freq	=  600000,
+		.varm	= 1125000,
+		.vint	= 1100000,
 	}, {
 		.freq	=  400000,
 		.varm	= 1050000,
 		.vint	= 1100000,
+	}, {
+		.freq	=  300000,
+		.varm	= 1000000,
+		.vint	= 1100000,
 	}, {
 		.freq	=  200000,
 		.varm	=  950000,
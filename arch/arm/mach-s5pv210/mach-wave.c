@@ -61,6 +61,7 @@
 #include <linux/android_pmem.h>
 #endif
 
+#include <linux/ion.h>
 #include <plat/media.h>
 #include <mach/media.h>
 
@@ -357,6 +358,7 @@ static struct s3cfb_lcd s6e63m0 = {
 #define  S5PV210_ANDROID_PMEM_MEMSIZE_PMEM_GPU1 (3000 * SZ_1K)
 #define  S5PV210_ANDROID_PMEM_MEMSIZE_PMEM_ADSP (1500 * SZ_1K)
 #define  S5PV210_VIDEO_SAMSUNG_MEMSIZE_TEXTSTREAM (3000 * SZ_1K)
+#define  S5PV210_ION_MEMSIZE_CARVEOUT (8192 * SZ_1K)
 
 
 static struct s5p_media_device wave_media_devs[] = {
@@ -366,6 +368,7 @@ static struct s5p_media_device wave_media_devs[] = {
 		.bank = 0,
 		.memsize = S5PV210_VIDEO_SAMSUNG_MEMSIZE_MFC0,
 		.paddr = 0,
+		.reclaimable = 1,
 	},
 	[1] = {
 		.id = S5P_MDEV_MFC,
@@ -373,6 +376,7 @@ static struct s5p_media_device wave_media_devs[] = {
 		.bank = 1,
 		.memsize = S5PV210_VIDEO_SAMSUNG_MEMSIZE_MFC1,
 		.paddr = 0,
+		.reclaimable = 1,
 	},
 	[2] = {
 		.id = S5P_MDEV_FIMC0,
@@ -380,6 +384,7 @@ static struct s5p_media_device wave_media_devs[] = {
 		.bank = 1,
 		.memsize = S5PV210_VIDEO_SAMSUNG_MEMSIZE_FIMC0,
 		.paddr = 0,
+		.reclaimable = 1,
 	},
 /*	[3] = {
 		.id = S5P_MDEV_FIMC1,
@@ -394,6 +399,7 @@ static struct s5p_media_device wave_media_devs[] = {
 		.bank = 1,
 		.memsize = S5PV210_VIDEO_SAMSUNG_MEMSIZE_FIMC2,
 		.paddr = 0,
+		.reclaimable = 1,
 	},
 	[5] = {
 		.id = S5P_MDEV_JPEG,
@@ -401,6 +407,7 @@ static struct s5p_media_device wave_media_devs[] = {
 		.bank = 0,
 		.memsize = S5PV210_VIDEO_SAMSUNG_MEMSIZE_JPEG,
 		.paddr = 0,
+		.reclaimable = 1,
 	},
 	[6] = {
 		.id = S5P_MDEV_FIMD,
@@ -439,6 +446,16 @@ static struct s5p_media_device wave_media_devs[] = {
 		.paddr = 0,
 	},	
 #endif
+#ifdef CONFIG_ION_S5P
+	[11] = {
+		.id = S5P_MDEV_ION,
+		.name = "ion",
+		.bank = 1,
+		.memsize = S5PV210_ION_MEMSIZE_CARVEOUT,
+		.paddr = 0,
+		.reclaimable = 1,
+	},
+#endif
 };
 
 #ifdef CONFIG_CPU_FREQ
@@ -455,10 +472,18 @@ static struct s5pv210_cpufreq_voltage smdkc110_cpufreq_volt[] = {
 		.freq	=  800000,
 		.varm	= 1200000,
 		.vint	= 1100000,
+	}, {
+		.freq	=  600000,
+		.varm	= 1125000,
+		.vint	= 1100000,
 	}, {
 		.freq	=  400000,
 		.varm	= 1050000,
 		.vint	= 1100000,
+	}, {
+		.freq	=  300000,
+		.varm	= 1000000,
+		.vint	= 1100000,
 	}, {
 		.freq	=  200000,
 		.varm	=  950000,
@@ -2365,6 +2390,34 @@ static void __init android_pmem_set_platdata(void)
 }
 #endif
 
+#ifdef CONFIG_ION_S5P
+/* Contiguous buffers shared by fd between FIMC and the overlay windows */
+static struct ion_platform_data ion_s5p_pdata = {
+	.nr = 1,
+	.heaps = {
+		{
+			.type = ION_HEAP_TYPE_CARVEOUT,
+			.id = ION_HEAP_TYPE_CARVEOUT,
+			.name = "carveout",
+		},
+	},
+};
+
+static struct platform_device ion_s5p_device = {
+	.name = "ion-s5p",
+	.id = -1,
+	.dev = { .platform_data = &ion_s5p_pdata },
+};
+
+static void __init ion_s5p_set_platdata(void)
+{
+	ion_s5p_pdata.heaps[0].base =
+		s5p_get_media_memory_bank(S5P_MDEV_ION, 1);
+	ion_s5p_pdata.heaps[0].size =
+		s5p_get_media_memsize_bank(S5P_MDEV_ION, 1);
+}
+#endif
+
 struct platform_device wave_charger_device = {
 	.name	= "wave_charger",
 	.id	= -1,
@@ -4719,6 +4772,9 @@ static struct platform_device *wave_devices[] __initdata = {
 	&pmem_gpu1_device,
 	&pmem_adsp_device,
 #endif
+#ifdef CONFIG_ION_S5P
+	&ion_s5p_device,
+#endif
 
 #ifdef CONFIG_HAVE_PWM
 	&s3c_device_timer[0],
@@ -5012,6 +5068,9 @@ static void __init wave_machine_init(void)
 #ifdef CONFIG_ANDROID_PMEM
 	android_pmem_set_platdata();
 #endif
+#ifdef CONFIG_ION_S5P
+	ion_s5p_set_platdata();
+#endif
 
 
 	samsung_keypad_set_platdata(&wave_keypad_data);
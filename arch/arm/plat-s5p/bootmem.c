@@ -14,7 +14,10 @@
 #include <linux/memblock.h>
 #include <linux/mm.h>
 #include <linux/swap.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
 #include <asm/setup.h>
+#include <asm/cacheflush.h>
 #include <linux/io.h>
 #include <mach/memory.h>
 #include <plat/media.h>
@@ -25,6 +28,33 @@ static int nr_media_devs;
 
 static dma_addr_t media_base[NR_BANKS];
 
+#ifdef CONFIG_CMA
+#define MEDIA_AREA_ALIGN	(pageblock_nr_pages << PAGE_SHIFT)
+
+/*
+ * Shared carveout of one bank. Claims are counted per pageblock since
+ * device ranges may overlap (jpeg lives inside mfc).
+ */
+struct s5p_media_area {
+	dma_addr_t	base;
+	size_t		size;
+	u8		*users;
+};
+
+static struct s5p_media_area media_areas[NR_BANKS];
+static DEFINE_MUTEX(media_area_lock);
+
+static inline int s5p_media_reclaimable(struct s5p_media_device *mdev)
+{
+	return mdev->reclaimable;
+}
+#else
+static inline int s5p_media_reclaimable(struct s5p_media_device *mdev)
+{
+	return 0;
+}
+#endif
+
 static struct s5p_media_device *s5p_get_media_device(int dev_id, int bank)
 {
 	struct s5p_media_device *mdev = NULL;
@@ -91,13 +121,103 @@ dma_addr_t s5p_get_media_membase_bank(int bank)
 }
 EXPORT_SYMBOL(s5p_get_media_membase_bank);
 
+#ifdef CONFIG_CMA
+static void __init s5p_reserve_media_area(int bank, size_t boundary)
+{
+	struct s5p_media_area *area = &media_areas[bank];
+	struct s5p_media_device *mdev;
+	dma_addr_t paddr;
+	u64 start, end;
+	size_t size = 0;
+	int i;
+
+	for (i = 0; i < nr_media_devs; i++) {
+		mdev = &media_devs[i];
+		if (mdev->bank == bank && mdev->reclaimable &&
+		    strcmp(mdev->name, "jpeg"))
+			size += PAGE_ALIGN(mdev->memsize);
+	}
+
+	if (!size)
+		return;
+
+	size = ALIGN(size, MEDIA_AREA_ALIGN);
+
+	start = meminfo.bank[bank].start;
+	end = start + meminfo.bank[bank].size;
+
+	if (boundary && (boundary < end - start))
+		start = end - boundary;
+
+	paddr = memblock_find_in_range(start, end, size, MEDIA_AREA_ALIGN);
+	if (paddr == MEMBLOCK_ERROR || memblock_reserve(paddr, size) < 0) {
+		pr_err("s5p: no room for a %lu byte shared area in bank %d\n",
+			(unsigned long) size, bank);
+		/* they get private carveouts as before */
+		for (i = 0; i < nr_media_devs; i++)
+			if (media_devs[i].bank == bank)
+				media_devs[i].reclaimable = 0;
+		return;
+	}
+
+	area->base = paddr;
+	area->size = size;
+
+	for (i = 0; i < nr_media_devs; i++) {
+		mdev = &media_devs[i];
+		if (mdev->bank != bank || !mdev->reclaimable ||
+		    !strcmp(mdev->name, "jpeg"))
+			continue;
+
+		mdev->paddr = paddr;
+		paddr += PAGE_ALIGN(mdev->memsize);
+
+		if (media_base[bank] > mdev->paddr)
+			media_base[bank] = mdev->paddr;
+
+		printk(KERN_INFO "s5p: %lu bytes reclaimable memory set aside "
+			"for %s at 0x%08x, %d-bank base(0x%08x)\n",
+			(unsigned long) mdev->memsize, mdev->name, mdev->paddr,
+			mdev->bank, media_base[bank]);
+	}
+}
+
+static void __init s5p_reserve_media_areas(size_t boundary)
+{
+	struct s5p_media_device *mdev, *mfc;
+	int i;
+
+	/* A fixed address cannot be placed in a shared area */
+	for (i = 0; i < nr_media_devs; i++) {
+		mdev = &media_devs[i];
+		if (mdev->memsize <= 0 || mdev->paddr)
+			mdev->reclaimable = 0;
+	}
+
+	for (i = 0; i < meminfo.nr_banks; i++)
+		s5p_reserve_media_area(i, boundary);
+
+	/* jpeg borrows the mfc buffer and follows its fate */
+	mfc = s5p_get_media_device(S5P_MDEV_MFC, 0);
+	for (i = 0; i < nr_media_devs; i++) {
+		mdev = &media_devs[i];
+		if (mdev->memsize <= 0 || strcmp(mdev->name, "jpeg"))
+			continue;
+
+		mdev->reclaimable = mfc && mfc->reclaimable;
+		if (mdev->reclaimable)
+			mdev->paddr = mfc->paddr;
+	}
+}
+#endif
+
 void s5p_reserve_bootmem(struct s5p_media_device *mdevs,
 			 int nr_mdevs, size_t boundary)
 {
 	struct s5p_media_device *mdev;
 	u64 start, end;
 	int i, ret;
-	dma_addr_t mfc_paddr;
+	dma_addr_t mfc_paddr = 0;
 
 	media_devs = mdevs;
 	nr_media_devs = nr_mdevs;
@@ -105,9 +225,13 @@ void s5p_reserve_bootmem(struct s5p_media_device *mdevs,
 	for (i = 0; i < meminfo.nr_banks; i++)
 		media_base[i] = meminfo.bank[i].start + meminfo.bank[i].size;
 
+#ifdef CONFIG_CMA
+	s5p_reserve_media_areas(boundary);
+#endif
+
 	for (i = 0; i < nr_media_devs; i++) {
 		mdev = &media_devs[i];
-		if (mdev->memsize <= 0)
+		if (mdev->memsize <= 0 || s5p_media_reclaimable(mdev))
 			continue;
 
 		if (!strcmp(mdev->name, "jpeg"))
@@ -142,6 +266,158 @@ void s5p_reserve_bootmem(struct s5p_media_device *mdevs,
 	}
 }
 
+#ifdef CONFIG_CMA
+/* Hand the shared areas to the page allocator */
+static int __init s5p_media_area_init(void)
+{
+	struct s5p_media_area *area;
+	unsigned long pfn, end_pfn;
+	int bank;
+
+	for (bank = 0; bank < NR_BANKS; bank++) {
+		area = &media_areas[bank];
+		if (!area->size)
+			continue;
+
+		area->users = kzalloc(area->size / MEDIA_AREA_ALIGN,
+				      GFP_KERNEL);
+		BUG_ON(!area->users);
+
+		pfn = __phys_to_pfn(area->base);
+		end_pfn = pfn + (area->size >> PAGE_SHIFT);
+		for (; pfn < end_pfn; pfn += pageblock_nr_pages)
+			init_cma_reserved_pageblock(pfn_to_page(pfn));
+	}
+
+	return 0;
+}
+core_initcall(s5p_media_area_init);
+
+/*
+ * The pages may have been written through the cacheable kernel mapping
+ * before they were migrated away; the device must not see stale lines
+ * written back over its data later.
+ */
+static void s5p_media_flush_block(unsigned long pfn)
+{
+	void *vaddr = page_address(pfn_to_page(pfn));
+	phys_addr_t paddr = __pfn_to_phys(pfn);
+
+	dmac_flush_range(vaddr, vaddr + MEDIA_AREA_ALIGN);
+	outer_flush_range(paddr, paddr + MEDIA_AREA_ALIGN);
+}
+
+/**
+ * s5p_media_memory_claim() - make a media device's memory usable
+ * @dev_id:	S5P_MDEV_* id
+ * @bank:	memory bank
+ *
+ * Migrates the page allocator's pages out of the device's range. Does
+ * nothing for devices that own a private carveout. Sleeps.
+ */
+int s5p_media_memory_claim(int dev_id, int bank)
+{
+	struct s5p_media_device *mdev;
+	struct s5p_media_area *area;
+	unsigned long base_pfn;
+	int first, last, blk, ret = 0;
+
+	mdev = s5p_get_media_device(dev_id, bank);
+	if (!mdev || !mdev->reclaimable)
+		return 0;
+
+	area = &media_areas[mdev->bank];
+	base_pfn = __phys_to_pfn(area->base);
+	first = (mdev->paddr - area->base) / MEDIA_AREA_ALIGN;
+	last = (mdev->paddr + mdev->memsize - 1 - area->base) /
+		MEDIA_AREA_ALIGN;
+
+	mutex_lock(&media_area_lock);
+
+	for (blk = first; blk <= last; blk++) {
+		unsigned long pfn = base_pfn + blk * pageblock_nr_pages;
+
+		if (area->users[blk])
+			continue;
+
+		ret = alloc_contig_range(pfn, pfn + pageblock_nr_pages);
+		if (ret)
+			goto undo;
+
+		s5p_media_flush_block(pfn);
+	}
+
+	for (blk = first; blk <= last; blk++)
+		area->users[blk]++;
+
+	mutex_unlock(&media_area_lock);
+	return 0;
+
+undo:
+	while (--blk >= first)
+		if (!area->users[blk])
+			free_contig_range(base_pfn + blk * pageblock_nr_pages,
+					  pageblock_nr_pages);
+
+	mutex_unlock(&media_area_lock);
+
+	pr_err("s5p: cannot reclaim memory for %s (%d)\n", mdev->name, ret);
+	return ret;
+}
+EXPORT_SYMBOL(s5p_media_memory_claim);
+
+/**
+ * s5p_media_memory_release() - give a media device's memory back
+ * @dev_id:	S5P_MDEV_* id
+ * @bank:	memory bank
+ *
+ * Pairs with a successful s5p_media_memory_claim(). The hardware must
+ * be idle and no user mappings of the range may remain.
+ */
+void s5p_media_memory_release(int dev_id, int bank)
+{
+	struct s5p_media_device *mdev;
+	struct s5p_media_area *area;
+	unsigned long base_pfn;
+	int first, last, blk;
+
+	mdev = s5p_get_media_device(dev_id, bank);
+	if (!mdev || !mdev->reclaimable)
+		return;
+
+	area = &media_areas[mdev->bank];
+	base_pfn = __phys_to_pfn(area->base);
+	first = (mdev->paddr - area->base) / MEDIA_AREA_ALIGN;
+	last = (mdev->paddr + mdev->memsize - 1 - area->base) /
+		MEDIA_AREA_ALIGN;
+
+	mutex_lock(&media_area_lock);
+
+	for (blk = first; blk <= last; blk++) {
+		if (WARN_ON(!area->users[blk]))
+			continue;
+
+		if (!--area->users[blk])
+			free_contig_range(base_pfn + blk * pageblock_nr_pages,
+					  pageblock_nr_pages);
+	}
+
+	mutex_unlock(&media_area_lock);
+}
+EXPORT_SYMBOL(s5p_media_memory_release);
+#else
+int s5p_media_memory_claim(int dev_id, int bank)
+{
+	return 0;
+}
+EXPORT_SYMBOL(s5p_media_memory_claim);
+
+void s5p_media_memory_release(int dev_id, int bank)
+{
+}
+EXPORT_SYMBOL(s5p_media_memory_release);
+#endif
+
 /* FIXME: temporary implementation to avoid compile error */
 int dma_needs_bounce(struct device *dev, dma_addr_t addr, size_t size)
 {
@@ -0,0 +1,45 @@
+/* linux/arch/arm/plat-s5p/include/plat/ion.h
+ *
+ * Buffer sharing between the S5P media drivers through ion
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+*/
+
+#ifndef _S5P_ION_H
+#define _S5P_ION_H
+
+#include <linux/err.h>
+#include <linux/ion.h>
+
+#ifdef CONFIG_ION_S5P
+extern struct ion_client *s5p_ion_client_create(const char *name);
+extern struct ion_handle *s5p_ion_import_fd(struct ion_client *client, int fd,
+					    dma_addr_t *phys, size_t *len);
+
+static inline void s5p_ion_free(struct ion_client *client,
+				struct ion_handle *handle)
+{
+	ion_free(client, handle);
+}
+#else
+static inline struct ion_client *s5p_ion_client_create(const char *name)
+{
+	return ERR_PTR(-ENODEV);
+}
+
+static inline struct ion_handle *s5p_ion_import_fd(struct ion_client *client,
+						   int fd, dma_addr_t *phys,
+						   size_t *len)
+{
+	return ERR_PTR(-ENODEV);
+}
+
+static inline void s5p_ion_free(struct ion_client *client,
+				struct ion_handle *handle)
+{
+}
+#endif
+
+#endif
@@ -16,12 +16,19 @@
 #include <linux/types.h>
 #include <asm/setup.h>
 
+/*
+ * With CONFIG_CMA, devices marked reclaimable share one carveout per
+ * bank that the page allocator fills with movable pages while nobody
+ * claims it. Their paddr is fixed at boot; the driver has to hold a
+ * claim while the hardware or userspace may touch the memory.
+ */
 struct s5p_media_device {
 	u32		id;
 	const char	*name;
 	u32		bank;
 	size_t		memsize;
 	dma_addr_t	paddr;
+	int		reclaimable;
 };
 
 extern struct meminfo meminfo;
@@ -29,6 +36,8 @@ extern dma_addr_t s5p_get_media_memory_bank(int dev_id, int bank);
 extern size_t s5p_get_media_memsize_bank(int dev_id, int bank);
 extern dma_addr_t s5p_get_media_membase_bank(int bank);
 extern void s5p_reserve_bootmem(struct s5p_media_device *mdevs, int nr_mdevs, size_t boundary);
+extern int s5p_media_memory_claim(int dev_id, int bank);
+extern void s5p_media_memory_release(int dev_id, int bank);
 
 #endif
 
@@ -11,6 +11,7 @@
 #include <linux/module.h>
 #include <linux/types.h>
 #include <linux/cpu.h>
+#include <linux/hardirq.h>
 #include <linux/kernel.h>
 #include <linux/notifier.h>
 #include <linux/signal.h>
@@ -19,6 +20,7 @@
 #include <linux/init.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -403,17 +405,18 @@ static void vfp_enable(void *unused)
 	set_copro_access(access | CPACC_FULL(10) | CPACC_FULL(11));
 }
 
-#ifdef CONFIG_PM
-#include <linux/syscore_ops.h>
-
-static int vfp_pm_suspend(void)
+/*
+ * Save whatever VFP context is live in the hardware before the core
+ * loses power. Used by suspend and by idle drivers that power gate the
+ * core behind the kernel's back.
+ */
+void vfp_pm_save_context(void)
 {
 	struct thread_info *ti = current_thread_info();
 	u32 fpexc = fmrx(FPEXC);
 
 	/* if vfp is on, then save state for resumption */
 	if (fpexc & FPEXC_EN) {
-		printk(KERN_DEBUG "%s: saving vfp state\n", __func__);
 		vfp_save_state(&ti->vfpstate, fpexc);
 
 		/* disable, just in case */
@@ -428,11 +431,9 @@ static int vfp_pm_suspend(void)
 
 	/* clear any information we had about last context state */
 	vfp_current_hw_state[ti->cpu] = NULL;
-
-	return 0;
 }
 
-static void vfp_pm_resume(void)
+void vfp_pm_restore_context(void)
 {
 	/* ensure we have access to the vfp */
 	vfp_enable(NULL);
@@ -441,6 +442,21 @@ static void vfp_pm_resume(void)
 	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
 }
 
+#ifdef CONFIG_PM
+#include <linux/syscore_ops.h>
+
+static int vfp_pm_suspend(void)
+{
+	vfp_pm_save_context();
+
+	return 0;
+}
+
+static void vfp_pm_resume(void)
+{
+	vfp_pm_restore_context();
+}
+
 static struct syscore_ops vfp_pm_syscore_ops = {
 	.suspend	= vfp_pm_suspend,
 	.resume		= vfp_pm_resume,
@@ -510,6 +526,65 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_NEON
+static bool kernel_neon_active[NR_CPUS];
+
+/*
+ * Kernel mode NEON is only allowed outside of interrupt context and with
+ * preemption disabled, so the kernel's own use of the registers never has
+ * to be preserved.  Whatever VFP context is live in the hardware is saved
+ * to its owner, which reloads it lazily on its next VFP instruction.
+ * Sections do not nest: the inner kernel_neon_end() would turn the unit
+ * off under the outer one.
+ */
+void kernel_neon_begin(void)
+{
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+	BUG_ON(kernel_neon_active[cpu]);
+	kernel_neon_active[cpu] = true;
+
+	fpexc = fmrx(FPEXC);
+	fmxr(FPEXC, fpexc | FPEXC_EN);
+
+	/*
+	 * On UP the hardware can hold the context of a task other than
+	 * current.  On SMP the switch notifier has already saved any state
+	 * not belonging to current, and then left the VFP disabled.
+	 */
+#ifdef CONFIG_SMP
+	if ((fpexc & FPEXC_EN) && vfp_current_hw_state[cpu])
+#else
+	if (vfp_current_hw_state[cpu])
+#endif
+		vfp_save_state(vfp_current_hw_state[cpu], fpexc | FPEXC_EN);
+	vfp_current_hw_state[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	kernel_neon_active[smp_processor_id()] = false;
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+/*
+ * Whether the caller is inside a kernel_neon_begin() section.  A section
+ * cannot be preempted, so the flag of the CPU we happen to run on can
+ * only have been set by us.
+ */
+bool kernel_neon_busy(void)
+{
+	return kernel_neon_active[raw_smp_processor_id()];
+}
+EXPORT_SYMBOL(kernel_neon_busy);
+#endif
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
@@ -28,6 +28,7 @@
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/input.h>
 #include <asm/cputime.h>
 
 #define CREATE_TRACE_POINTS
@@ -51,6 +52,9 @@ struct cpufreq_interactive_cpuinfo {
 	u64 floor_validate_time;
 	u64 hispeed_validate_time;
 	int governor_enabled;
+	/* Microseconds at each freq_table entry, kept on policy->cpu */
+	u64 *time_in_state;
+	u64 stats_time;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -100,6 +104,33 @@ static unsigned long above_hispeed_delay_val;
 
 static int boost_val;
 
+/*
+ * Go to hi speed on touch or key input and stay there for this long.
+ * Zero disables the input boost.
+ */
+#define DEFAULT_INPUT_BOOST_DURATION (200 * USEC_PER_MSEC)
+static unsigned long input_boost_duration;
+/* 64 bit, so written and read under input_boost_lock */
+static u64 input_boost_end;
+static DEFINE_SPINLOCK(input_boost_lock);
+static bool input_handler_registered;
+
+/*
+ * Ramping down must pay for itself: hold a speed for at least this many
+ * times the average transition latency, when that is longer than
+ * min_sample_time. The latency is measured around the driver's target
+ * call and so includes PLL relocking, DMC refresh updates and
+ * regulator ramps.
+ */
+#define DEFAULT_TRANSITION_COST_RATIO 100
+static unsigned long transition_cost_ratio;
+
+/* Protects time_in_state and the transition statistics */
+static DEFINE_SPINLOCK(stats_lock);
+static unsigned int transition_count;
+static unsigned int transition_avg_us;
+static unsigned int transition_max_us;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -113,6 +144,13 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+static u64 cpufreq_interactive_hold_time(void)
+{
+	u64 cost = (u64)transition_avg_us * transition_cost_ratio;
+
+	return max_t(u64, min_sample_time, cost);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -128,6 +166,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 	unsigned int index;
 	unsigned long flags;
 	u64 now = ktime_to_us(ktime_get());
+	u64 boost_end;
 
 	smp_rmb();
 
@@ -194,7 +233,12 @@ static void cpufreq_interactive_timer(unsigned long data)
 		boostpulse_duration = 0;
 	}
 
-	if (cpu_load >= go_hispeed_load || boost_val || boostpulse_boosted_time) {
+	spin_lock_irqsave(&input_boost_lock, flags);
+	boost_end = input_boost_end;
+	spin_unlock_irqrestore(&input_boost_lock, flags);
+
+	if (cpu_load >= go_hispeed_load || boost_val || boostpulse_boosted_time ||
+	    now < boost_end) {
 		if (pcpu->target_freq < hispeed_freq &&
 		    hispeed_freq < pcpu->policy->max) {
 			new_freq = hispeed_freq;
@@ -234,12 +278,12 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	/*
 	 * Do not scale below floor_freq unless we have been at or above the
-	 * floor frequency for the minimum sample time since last validated.
+	 * floor frequency for the hold time since last validated.
 	 */
 	if (new_freq < pcpu->floor_freq) {
 		if (cputime64_sub(pcpu->timer_run_time,
 				  pcpu->floor_validate_time)
-		    < min_sample_time) {
+		    < cpufreq_interactive_hold_time()) {
 			trace_cpufreq_interactive_notyet(data, cpu_load,
 					 pcpu->target_freq, new_freq);
 			goto rearm;
@@ -387,6 +431,62 @@ static void cpufreq_interactive_idle_end(void)
 
 }
 
+static int cpufreq_interactive_freq_index(
+	struct cpufreq_frequency_table *table, unsigned int freq)
+{
+	int i;
+
+	for (i = 0; table[i].frequency != CPUFREQ_TABLE_END; i++)
+		if (table[i].frequency == freq)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Change speed and account for it: the time spent at the old speed and
+ * what the transition cost.
+ */
+static void cpufreq_interactive_set_speed(struct cpufreq_policy *policy,
+					  unsigned int freq,
+					  unsigned int relation)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu =
+		&per_cpu(cpuinfo, policy->cpu);
+	unsigned int old_freq = policy->cur;
+	unsigned int latency;
+	u64 start, now;
+	int i;
+
+	start = ktime_to_us(ktime_get());
+	__cpufreq_driver_target(policy, freq, relation);
+	now = ktime_to_us(ktime_get());
+
+	if (policy->cur == old_freq)
+		return;
+
+	latency = (unsigned int)(now - start);
+	trace_cpufreq_interactive_transition(policy->cpu, old_freq,
+					     policy->cur, latency);
+
+	spin_lock(&stats_lock);
+	if (pcpu->time_in_state) {
+		i = cpufreq_interactive_freq_index(pcpu->freq_table,
+						   old_freq);
+		if (i >= 0)
+			pcpu->time_in_state[i] += now - pcpu->stats_time;
+		pcpu->stats_time = now;
+	}
+
+	if (transition_count++)
+		transition_avg_us = (transition_avg_us * 7 + latency) / 8;
+	else
+		transition_avg_us = latency;
+	if (latency > transition_max_us)
+		transition_max_us = latency;
+	spin_unlock(&stats_lock);
+}
+
 static int cpufreq_interactive_speedchange_task(void *data)
 {
 	unsigned int cpu;
@@ -433,9 +533,9 @@ static int cpufreq_interactive_speedchange_task(void *data)
 			}
 
 			if (max_freq != pcpu->policy->cur)
-				__cpufreq_driver_target(pcpu->policy,
-							max_freq,
-							CPUFREQ_RELATION_H);
+				cpufreq_interactive_set_speed(pcpu->policy,
+							      max_freq,
+							      CPUFREQ_RELATION_H);
 			trace_cpufreq_interactive_setspeed(cpu,
 						     pcpu->target_freq,
 						     pcpu->policy->cur);
@@ -481,6 +581,105 @@ static void cpufreq_interactive_boost(void)
 		wake_up_process(speedchange_task);
 }
 
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	u64 now, end;
+	unsigned long flags;
+
+	if (!input_boost_duration)
+		return;
+
+	/* key releases do not need a boost, a touch stream does */
+	if (!(type == EV_KEY && value) && type != EV_ABS)
+		return;
+
+	now = ktime_to_us(ktime_get());
+	spin_lock_irqsave(&input_boost_lock, flags);
+	end = input_boost_end;
+	input_boost_end = now + input_boost_duration;
+	spin_unlock_irqrestore(&input_boost_lock, flags);
+	if (now < end)
+		return;
+
+	trace_cpufreq_interactive_boost("input");
+	cpufreq_interactive_boost();
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	/* multi-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* single-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	/* keys and keypads */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
 static ssize_t show_hispeed_freq(struct kobject *kobj,
 				 struct attribute *attr, char *buf)
 {
@@ -653,6 +852,110 @@ static ssize_t store_boostpulse(struct kobject *kobj, struct attribute *attr,
 static struct global_attr boostpulse =
 	__ATTR(boostpulse, 0200, show_boostpulse, store_boostpulse);
 
+static ssize_t show_input_boost_duration(struct kobject *kobj,
+					 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_duration);
+}
+
+static ssize_t store_input_boost_duration(struct kobject *kobj,
+					  struct attribute *attr,
+					  const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val > MAX_BOOSTPULSE_DURATION)
+		return -EINVAL;
+	input_boost_duration = val;
+	return count;
+}
+
+static struct global_attr input_boost_duration_attr =
+	__ATTR(input_boost_duration, 0644, show_input_boost_duration,
+	       store_input_boost_duration);
+
+static ssize_t show_transition_cost_ratio(struct kobject *kobj,
+					  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", transition_cost_ratio);
+}
+
+static ssize_t store_transition_cost_ratio(struct kobject *kobj,
+					   struct attribute *attr,
+					   const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	transition_cost_ratio = val;
+	return count;
+}
+
+static struct global_attr transition_cost_ratio_attr =
+	__ATTR(transition_cost_ratio, 0644, show_transition_cost_ratio,
+	       store_transition_cost_ratio);
+
+/* One "<frequency> <milliseconds>" line per table entry and policy */
+static ssize_t show_time_in_state(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int cpu;
+	ssize_t len = 0;
+	u64 now, time;
+	int i;
+
+	spin_lock(&stats_lock);
+	now = ktime_to_us(ktime_get());
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		if (!pcpu->time_in_state)
+			continue;
+
+		for (i = 0; pcpu->freq_table[i].frequency !=
+			    CPUFREQ_TABLE_END; i++) {
+			if (pcpu->freq_table[i].frequency ==
+			    CPUFREQ_ENTRY_INVALID)
+				continue;
+
+			time = pcpu->time_in_state[i];
+			if (pcpu->freq_table[i].frequency == pcpu->policy->cur)
+				time += now - pcpu->stats_time;
+			do_div(time, USEC_PER_MSEC);
+			len += sprintf(buf + len, "%u %llu\n",
+				       pcpu->freq_table[i].frequency, time);
+		}
+	}
+	spin_unlock(&stats_lock);
+
+	return len;
+}
+
+define_one_global_ro(time_in_state);
+
+static ssize_t show_transition_stats(struct kobject *kobj,
+				     struct attribute *attr, char *buf)
+{
+	ssize_t len;
+
+	spin_lock(&stats_lock);
+	len = sprintf(buf, "transitions %u\navg_latency_us %u\n"
+		      "max_latency_us %u\n", transition_count,
+		      transition_avg_us, transition_max_us);
+	spin_unlock(&stats_lock);
+
+	return len;
+}
+
+define_one_global_ro(transition_stats);
+
 static struct attribute *interactive_attributes[] = {
 	&hispeed_freq_attr.attr,
 	&go_hispeed_load_attr.attr,
@@ -661,6 +964,10 @@ static struct attribute *interactive_attributes[] = {
 	&timer_rate_attr.attr,
 	&boost.attr,
 	&boostpulse.attr,
+	&input_boost_duration_attr.attr,
+	&transition_cost_ratio_attr.attr,
+	&time_in_state.attr,
+	&transition_stats.attr,
 	NULL,
 };
 
@@ -696,6 +1003,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 	unsigned int j;
 	struct cpufreq_interactive_cpuinfo *pcpu;
 	struct cpufreq_frequency_table *freq_table;
+	u64 *time_in_state;
 
 	switch (event) {
 	case CPUFREQ_GOV_START:
@@ -728,6 +1036,15 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (!hispeed_freq)
 			hispeed_freq = policy->max;
 
+		for (j = 0; freq_table[j].frequency != CPUFREQ_TABLE_END; j++)
+			;
+		time_in_state = kcalloc(j, sizeof(u64), GFP_KERNEL);
+		pcpu = &per_cpu(cpuinfo, policy->cpu);
+		spin_lock(&stats_lock);
+		pcpu->time_in_state = time_in_state;
+		pcpu->stats_time = ktime_to_us(ktime_get());
+		spin_unlock(&stats_lock);
+
 		/*
 		 * Do not register the idle hook and create sysfs
 		 * entries if we have already done so.
@@ -741,6 +1058,13 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			return rc;
 
 		idle_notifier_register(&cpufreq_interactive_idle_nb);
+
+		rc = input_register_handler(&cpufreq_interactive_input_handler);
+		if (rc)
+			pr_warn("%s: failed to register input handler: %d\n",
+				__func__, rc);
+		else
+			input_handler_registered = true;
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -759,9 +1083,21 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->idle_exit_time = 0;
 		}
 
+		pcpu = &per_cpu(cpuinfo, policy->cpu);
+		spin_lock(&stats_lock);
+		time_in_state = pcpu->time_in_state;
+		pcpu->time_in_state = NULL;
+		spin_unlock(&stats_lock);
+		kfree(time_in_state);
+
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		if (input_handler_registered) {
+			input_unregister_handler(
+				&cpufreq_interactive_input_handler);
+			input_handler_registered = false;
+		}
 		idle_notifier_unregister(&cpufreq_interactive_idle_nb);
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
@@ -770,10 +1106,10 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 
 	case CPUFREQ_GOV_LIMITS:
 		if (policy->max < policy->cur)
-			__cpufreq_driver_target(policy,
+			cpufreq_interactive_set_speed(policy,
 					policy->max, CPUFREQ_RELATION_H);
 		else if (policy->min > policy->cur)
-			__cpufreq_driver_target(policy,
+			cpufreq_interactive_set_speed(policy,
 					policy->min, CPUFREQ_RELATION_L);
 		break;
 	}
@@ -790,6 +1126,8 @@ static int __init cpufreq_interactive_init(void)
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
 	above_hispeed_delay_val = DEFAULT_ABOVE_HISPEED_DELAY;
 	timer_rate = DEFAULT_TIMER_RATE;
+	input_boost_duration = DEFAULT_INPUT_BOOST_DURATION;
+	transition_cost_ratio = DEFAULT_TRANSITION_COST_RATIO;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -0,0 +1,204 @@
+/*
+ * drivers/gpu/ion/s5p/s5p_ion.c
+ *
+ * Ion device for S5PV210, with helpers for the media drivers that take
+ * shared buffers by fd.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/err.h>
+#include <linux/ion.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <mach/media.h>
+#include <plat/ion.h>
+#include <plat/media.h>
+#include "../ion_priv.h"
+
+static struct ion_device *s5p_ion_dev;
+static int num_heaps;
+static struct ion_heap **heaps;
+
+/*
+ * The carveout heap is the S5P_MDEV_ION media area of bank 1. With CMA
+ * that area is reclaimable: it is claimed from the page allocator with
+ * the first buffer and given back when the last one is freed.
+ */
+static struct ion_heap_ops *carveout_ops;
+static struct ion_heap_ops s5p_carveout_ops;
+static DEFINE_MUTEX(s5p_carveout_lock);
+static int s5p_carveout_buffers;
+
+static int s5p_carveout_allocate(struct ion_heap *heap,
+				 struct ion_buffer *buffer, unsigned long len,
+				 unsigned long align, unsigned long flags)
+{
+	int ret;
+
+	mutex_lock(&s5p_carveout_lock);
+
+	if (!s5p_carveout_buffers) {
+		ret = s5p_media_memory_claim(S5P_MDEV_ION, 1);
+		if (ret)
+			goto out;
+	}
+
+	ret = carveout_ops->allocate(heap, buffer, len, align, flags);
+	if (!ret)
+		s5p_carveout_buffers++;
+	else if (!s5p_carveout_buffers)
+		s5p_media_memory_release(S5P_MDEV_ION, 1);
+out:
+	mutex_unlock(&s5p_carveout_lock);
+	return ret;
+}
+
+static void s5p_carveout_free(struct ion_buffer *buffer)
+{
+	mutex_lock(&s5p_carveout_lock);
+
+	carveout_ops->free(buffer);
+	if (!--s5p_carveout_buffers)
+		s5p_media_memory_release(S5P_MDEV_ION, 1);
+
+	mutex_unlock(&s5p_carveout_lock);
+}
+
+/**
+ * s5p_ion_client_create() - client for a driver importing shared buffers
+ * @name:	shown in the ion debugfs entries
+ */
+struct ion_client *s5p_ion_client_create(const char *name)
+{
+	if (!s5p_ion_dev)
+		return ERR_PTR(-ENODEV);
+
+	return ion_client_create(s5p_ion_dev, -1, name);
+}
+EXPORT_SYMBOL(s5p_ion_client_create);
+
+/**
+ * s5p_ion_import_fd() - take a reference on a shared buffer for DMA
+ * @client:	client of the importing driver
+ * @fd:		fd returned to userspace by ION_IOC_SHARE
+ * @phys:	returns the bus address of the buffer
+ * @len:	returns the size of the buffer
+ *
+ * Only physically contiguous buffers can be imported, the S5PV210 media
+ * blocks have no IOMMU. The buffer stays alive until the handle is passed
+ * to ion_free(), even if every userspace fd is closed.
+ */
+struct ion_handle *s5p_ion_import_fd(struct ion_client *client, int fd,
+				     dma_addr_t *phys, size_t *len)
+{
+	struct ion_handle *handle;
+	ion_phys_addr_t addr;
+	int ret;
+
+	handle = ion_import_fd(client, fd);
+	if (IS_ERR_OR_NULL(handle))
+		return handle ? handle : ERR_PTR(-EINVAL);
+
+	ret = ion_phys(client, handle, &addr, len);
+	if (ret) {
+		ion_free(client, handle);
+		return ERR_PTR(ret);
+	}
+	*phys = addr;
+
+	return handle;
+}
+EXPORT_SYMBOL(s5p_ion_import_fd);
+
+static int s5p_ion_probe(struct platform_device *pdev)
+{
+	struct ion_platform_data *pdata = pdev->dev.platform_data;
+	struct ion_device *idev;
+	int err;
+	int i;
+
+	num_heaps = pdata->nr;
+
+	heaps = kzalloc(sizeof(struct ion_heap *) * pdata->nr, GFP_KERNEL);
+	if (!heaps)
+		return -ENOMEM;
+
+	idev = ion_device_create(NULL);
+	if (IS_ERR_OR_NULL(idev)) {
+		kfree(heaps);
+		return PTR_ERR(idev);
+	}
+
+	/* create the heaps as specified in the board file */
+	for (i = 0; i < num_heaps; i++) {
+		struct ion_platform_heap *heap_data = &pdata->heaps[i];
+
+		heaps[i] = ion_heap_create(heap_data);
+		if (IS_ERR_OR_NULL(heaps[i])) {
+			err = PTR_ERR(heaps[i]);
+			goto err;
+		}
+
+		if (heap_data->type == ION_HEAP_TYPE_CARVEOUT) {
+			carveout_ops = heaps[i]->ops;
+			s5p_carveout_ops = *carveout_ops;
+			s5p_carveout_ops.allocate = s5p_carveout_allocate;
+			s5p_carveout_ops.free = s5p_carveout_free;
+			heaps[i]->ops = &s5p_carveout_ops;
+		}
+		ion_device_add_heap(idev, heaps[i]);
+	}
+	platform_set_drvdata(pdev, idev);
+	s5p_ion_dev = idev;
+	return 0;
+err:
+	for (i = 0; i < num_heaps; i++) {
+		if (!IS_ERR_OR_NULL(heaps[i]))
+			ion_heap_destroy(heaps[i]);
+	}
+	ion_device_destroy(idev);
+	kfree(heaps);
+	return err;
+}
+
+static int s5p_ion_remove(struct platform_device *pdev)
+{
+	struct ion_device *idev = platform_get_drvdata(pdev);
+	int i;
+
+	s5p_ion_dev = NULL;
+	ion_device_destroy(idev);
+	for (i = 0; i < num_heaps; i++)
+		ion_heap_destroy(heaps[i]);
+	kfree(heaps);
+	return 0;
+}
+
+static struct platform_driver ion_driver = {
+	.probe = s5p_ion_probe,
+	.remove = s5p_ion_remove,
+	.driver = { .name = "ion-s5p" }
+};
+
+static int __init ion_init(void)
+{
+	return platform_driver_register(&ion_driver);
+}
+
+static void __exit ion_exit(void)
+{
+	platform_driver_unregister(&ion_driver);
+}
+
+module_init(ion_init);
+module_exit(ion_exit);
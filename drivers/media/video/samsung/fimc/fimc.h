@@ -27,6 +27,7 @@
 #include <media/videobuf-core.h>
 #include <plat/media.h>
 #include <plat/fimc.h>
+#include <plat/ion.h>
 #endif
 
 #define FIMC_NAME		"s3c-fimc"
@@ -152,6 +153,18 @@ struct fimc_buf {
 	size_t		length[3];
 };
 
+/*
+ * Output buffers queued as V4L2_MEMORY_USERPTR with FIMC_BUF_FLAG_ION set
+ * point m.userptr at this instead of a struct fimc_buf. The planes are
+ * given as offsets into the ion buffer behind fd.
+ */
+#define FIMC_BUF_FLAG_ION	0x00100000
+
+struct fimc_ion_buf {
+	int		fd;
+	u32		offset[3];
+};
+
 struct fimc_overlay_buf {
 	u32 vir_addr[3];
 	size_t size[3];
@@ -176,6 +189,7 @@ struct fimc_buf_set {
 	u32			flags;
 	atomic_t		mapped_cnt;
 	struct list_head	list;
+	struct ion_handle	*ion;		/* imported source buffer */
 };
 
 /* for capture device */
@@ -399,6 +413,7 @@ struct fimc_control {
 	enum fimc_log			log;
 
 	u32				ctx_busy[FIMC_MAX_CTXS];
+	struct ion_client		*ion_client;	/* lazily created */
 };
 
 /* global */
@@ -572,6 +587,8 @@ extern int fimc_push_outq(struct fimc_control *ctrl,
 extern int fimc_pop_outq(struct fimc_control *ctrl,
 					struct fimc_ctx *ctx, int *idx);
 extern int fimc_init_out_queue(struct fimc_control *ctrl, struct fimc_ctx *ctx);
+extern void fimc_outdev_release_ion(struct fimc_control *ctrl,
+				    struct fimc_ctx *ctx);
 extern void fimc_outdev_init_idxs(struct fimc_control *ctrl);
 
 extern void fimc_dump_context(struct fimc_control *ctrl, struct fimc_ctx *ctx);
@@ -919,6 +919,16 @@ static int fimc_open(struct file *filp)
 	}
 	in_use = atomic_read(&ctrl->in_use);
 
+	/* The reserved memory may be lent to the page allocator */
+	if (in_use == 1) {
+		ret = s5p_media_memory_claim(S5P_MDEV_FIMC0 + ctrl->id, 1);
+		if (ret) {
+			fimc_err("%s: reserved memory busy.\n", __func__);
+			ret = -ENOMEM;
+			goto claim_err;
+		}
+	}
+
 	prv_data = kzalloc(sizeof(struct fimc_prv_data), GFP_KERNEL);
 	if (!prv_data) {
 		fimc_err("%s: not enough memory\n", __func__);
@@ -970,6 +980,10 @@ ctx_err:
 	kfree(prv_data);
 
 kzalloc_err:
+	if (in_use == 1)
+		s5p_media_memory_release(S5P_MDEV_FIMC0 + ctrl->id, 1);
+
+claim_err:
 	atomic_dec(&ctrl->in_use);
 
 resource_busy:
@@ -1077,6 +1091,7 @@ static int fimc_release(struct file *filp)
 			}
 		}
 
+		fimc_outdev_release_ion(ctrl, ctx);
 		ctrl->ctx_busy[ctx_id] = 0;
 		memset(ctx, 0x00, sizeof(struct fimc_ctx));
 
@@ -1114,6 +1129,9 @@ static int fimc_release(struct file *filp)
 		ctrl->fb.is_enable = 0;
 	}
 
+	if (atomic_read(&ctrl->in_use) == 0)
+		s5p_media_memory_release(S5P_MDEV_FIMC0 + ctrl->id, 1);
+
 	mutex_unlock(&ctrl->lock);
 
 	fimc_info1("%s released.\n", ctrl->name);
@@ -1121,6 +1139,9 @@ static int fimc_release(struct file *filp)
 	return 0;
 
 release_err:
+	if (atomic_read(&ctrl->in_use) == 0)
+		s5p_media_memory_release(S5P_MDEV_FIMC0 + ctrl->id, 1);
+
 	mutex_unlock(&ctrl->lock);
 	return ret;
 
@@ -23,6 +23,7 @@
 #include <linux/mman.h>
 #include <plat/media.h>
 #include <linux/clk.h>
+#include <asm/cacheflush.h>
 
 #include "fimc.h"
 
@@ -1221,6 +1222,8 @@ int fimc_reqbufs_output(void *fh, struct v4l2_requestbuffers *b)
 	ctx->is_requested = 0;
 
 	if (b->count == 0) {
+		fimc_outdev_release_ion(ctrl, ctx);
+
 		ctrl->mem.curr = ctrl->mem.base;
 
 		switch (ctx->overlay.mode) {
@@ -1350,11 +1353,22 @@ int fimc_g_ctrl_output(void *fh, struct v4l2_control *c)
 			 * for both Camcorder recording and HDMI display.
 			 */
 			char *fimc_mem = NULL;
-			fimc_mem = (char *) ioremap(ctrl->mem.base, \
-							ctrl->mem.size);
-			if (fimc_mem) {
+
+			/* A reclaimable area is regular RAM, see plat/media.h */
+			if (pfn_valid(__phys_to_pfn(ctrl->mem.base))) {
+				fimc_mem = phys_to_virt(ctrl->mem.base);
 				memset(fimc_mem, 0x00, ctrl->mem.size);
-				iounmap(fimc_mem);
+				dmac_flush_range(fimc_mem,
+						fimc_mem + ctrl->mem.size);
+				outer_flush_range(ctrl->mem.base,
+						ctrl->mem.base + ctrl->mem.size);
+			} else {
+				fimc_mem = (char *) ioremap(ctrl->mem.base, \
+							ctrl->mem.size);
+				if (fimc_mem) {
+					memset(fimc_mem, 0x00, ctrl->mem.size);
+					iounmap(fimc_mem);
+				}
 			}
 		}
 		break;
@@ -2021,6 +2035,72 @@ static int fimc_update_in_queue_addr(struct fimc_control *ctrl,
 	return 0;
 }
 
+static void fimc_release_in_queue_ion(struct fimc_control *ctrl,
+				      struct fimc_ctx *ctx, u32 idx)
+{
+	if (ctx->src[idx].ion) {
+		s5p_ion_free(ctrl->ion_client, ctx->src[idx].ion);
+		ctx->src[idx].ion = NULL;
+	}
+}
+
+void fimc_outdev_release_ion(struct fimc_control *ctrl, struct fimc_ctx *ctx)
+{
+	u32 i;
+
+	for (i = 0; i < FIMC_OUTBUFS; i++)
+		fimc_release_in_queue_ion(ctrl, ctx, i);
+}
+
+/*
+ * Take the source frame straight from a shared ion buffer, e.g. one the
+ * decoder wrote, so userspace never handles its physical address. The
+ * import holds the buffer until the index is queued again or released.
+ */
+static int fimc_import_in_queue_ion(struct fimc_control *ctrl,
+				    struct fimc_ctx *ctx, u32 idx,
+				    struct fimc_ion_buf __user *ubuf)
+{
+	struct fimc_ion_buf ibuf;
+	struct ion_handle *handle;
+	dma_addr_t addr[3], phys;
+	size_t len;
+	int i;
+
+	if (idx >= FIMC_OUTBUFS)
+		return -EINVAL;
+
+	if (copy_from_user(&ibuf, ubuf, sizeof(ibuf)))
+		return -EFAULT;
+
+	if (!ctrl->ion_client) {
+		struct ion_client *client = s5p_ion_client_create(ctrl->name);
+
+		if (IS_ERR(client))
+			return PTR_ERR(client);
+		ctrl->ion_client = client;
+	}
+
+	handle = s5p_ion_import_fd(ctrl->ion_client, ibuf.fd, &phys, &len);
+	if (IS_ERR(handle)) {
+		fimc_err("%s: cannot import fd %d\n", __func__, ibuf.fd);
+		return PTR_ERR(handle);
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (ibuf.offset[i] >= len) {
+			s5p_ion_free(ctrl->ion_client, handle);
+			return -EINVAL;
+		}
+		addr[i] = phys + ibuf.offset[i];
+	}
+
+	fimc_release_in_queue_ion(ctrl, ctx, idx);
+	ctx->src[idx].ion = handle;
+
+	return fimc_update_in_queue_addr(ctrl, ctx, idx, addr);
+}
+
 int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 {
 	struct fimc_buf *buf = (struct fimc_buf *)b->m.userptr;
@@ -2048,7 +2128,14 @@ int fimc_qbuf_output(void *fh, struct v4l2_buffer *b)
 		return -EINVAL;
 	}
 
-	if (b->memory == V4L2_MEMORY_USERPTR) {
+	if (b->memory == V4L2_MEMORY_USERPTR &&
+	    (b->flags & FIMC_BUF_FLAG_ION)) {
+		ret = fimc_import_in_queue_ion(ctrl, ctx, b->index,
+				(struct fimc_ion_buf __user *)b->m.userptr);
+		if (ret < 0)
+			return ret;
+	} else if (b->memory == V4L2_MEMORY_USERPTR) {
+		fimc_release_in_queue_ion(ctrl, ctx, b->index);
 		ret = fimc_update_in_queue_addr(ctrl, ctx, b->index, buf->base);
 		if (ret < 0)
 			return ret;
@@ -16,6 +16,7 @@
 #include "jpg_misc.h"
 
 #include <linux/version.h>
+#include <plat/ion.h>
 #include <plat/media.h>
 #include <mach/media.h>
 
@@ -102,6 +103,9 @@ struct s5pc110_jpg_ctx {
 	int			caller_process;
 	struct jpegv2_limits	*limits;
 	struct jpegv2_buf	*bufinfo;
+	struct ion_handle	*frm_ion;	/* imported main frame */
+	unsigned int		frm_ion_addr;
+	unsigned int		frm_ion_size;
 };
 
 void *phy_to_vir_addr(unsigned int phy_addr, int mem_size);
@@ -144,6 +144,16 @@ struct jpg_args {
 	struct jpg_enc_proc_param	*thumb_enc_param;
 };
 
+/*
+ * IOCTL_JPG_SET_ION_FRMBUF: the main YUV frame is read (encode) or written
+ * (decode) at offset into the ion buffer behind fd instead of the reserved
+ * frame buffer. A negative fd drops the import.
+ */
+struct jpg_ion_buf {
+	int			fd;
+	unsigned int		offset;
+};
+
 void reset_jpg(struct s5pc110_jpg_ctx *jpg_ctx);
 enum jpg_return_status decode_jpg(struct s5pc110_jpg_ctx *jpg_ctx, \
 		struct jpg_dec_proc_param *dec_param);
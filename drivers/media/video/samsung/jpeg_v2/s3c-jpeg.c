@@ -62,6 +62,7 @@ static struct clk	*s3c_jpeg_clk;
 static struct regulator		*jpeg_pd_regulator;
 
 static struct resource	*s3c_jpeg_mem;
+static struct ion_client	*s3c_jpeg_ion_client;
 void __iomem		*s3c_jpeg_base;
 static int		irq_no;
 static int		instanceNo;;
@@ -125,6 +126,80 @@ irqreturn_t s3c_jpeg_irq(int irq, void *dev_id, struct pt_regs *regs)
 
 	return IRQ_HANDLED;
 }
+static void s3c_jpeg_release_ion(struct s5pc110_jpg_ctx *jpg_reg_ctx)
+{
+	if (jpg_reg_ctx->frm_ion) {
+		s5p_ion_free(s3c_jpeg_ion_client, jpg_reg_ctx->frm_ion);
+		jpg_reg_ctx->frm_ion = NULL;
+	}
+}
+
+/*
+ * Let the main frame come from (encode) or go to (decode) a shared ion
+ * buffer, e.g. a FIMC or overlay buffer, instead of being copied through
+ * the reserved frame buffer. The streams stay in the reserved memory.
+ */
+static enum BOOL s3c_jpeg_import_ion(struct s5pc110_jpg_ctx *jpg_reg_ctx,
+				     struct jpg_ion_buf __user *ubuf)
+{
+	struct jpg_ion_buf ibuf;
+	struct ion_handle *handle;
+	dma_addr_t phys;
+	size_t len;
+
+	if (copy_from_user(&ibuf, ubuf, sizeof(ibuf)))
+		return FALSE;
+
+	s3c_jpeg_release_ion(jpg_reg_ctx);
+
+	if (ibuf.fd < 0)
+		return TRUE;
+
+	if (!s3c_jpeg_ion_client) {
+		struct ion_client *client = s5p_ion_client_create("s3c-jpg");
+
+		if (IS_ERR(client)) {
+			jpg_err("no ion device\n");
+			return FALSE;
+		}
+		s3c_jpeg_ion_client = client;
+	}
+
+	handle = s5p_ion_import_fd(s3c_jpeg_ion_client, ibuf.fd, &phys, &len);
+	if (IS_ERR(handle)) {
+		jpg_err("cannot import fd %d\n", ibuf.fd);
+		return FALSE;
+	}
+
+	if (ibuf.offset >= len) {
+		s5p_ion_free(s3c_jpeg_ion_client, handle);
+		return FALSE;
+	}
+
+	jpg_reg_ctx->frm_ion = handle;
+	jpg_reg_ctx->frm_ion_addr = phys + ibuf.offset;
+	jpg_reg_ctx->frm_ion_size = len - ibuf.offset;
+
+	return TRUE;
+}
+
+/* Returns 0 if the imported frame cannot hold size bytes */
+static unsigned int s3c_jpeg_frm_addr(struct s5pc110_jpg_ctx *jpg_reg_ctx,
+				      unsigned int size)
+{
+	if (!jpg_reg_ctx->frm_ion)
+		return (unsigned int)jpg_data_base_addr
+			+ jpg_reg_ctx->bufinfo->main_frame_start;
+
+	if (jpg_reg_ctx->frm_ion_size < size) {
+		jpg_err("ion frame of %u bytes is less than %u bytes\n",
+			jpg_reg_ctx->frm_ion_size, size);
+		return 0;
+	}
+
+	return jpg_reg_ctx->frm_ion_addr;
+}
+
 static int s3c_jpeg_open(struct inode *inode, struct file *file)
 {
 	struct s5pc110_jpg_ctx *jpg_reg_ctx;
@@ -153,6 +228,14 @@ static int s3c_jpeg_open(struct inode *inode, struct file *file)
 		return FALSE;
 	}
 
+	/* The data buffer may be lent to the page allocator while closed */
+	if (!instanceNo && s5p_media_memory_claim(S5P_MDEV_JPEG, 0)) {
+		jpg_err("JPG buffer is not available\n");
+		unlock_jpg_mutex();
+		kfree(jpg_reg_ctx);
+		return -ENOMEM;
+	}
+
 	instanceNo++;
 
 	/* Initialize the limits of the driver */
@@ -188,8 +271,10 @@ static int s3c_jpeg_release(struct inode *inode, struct file *file)
 		return FALSE;
 	}
 
-	if ((--instanceNo) < 0)
-		instanceNo = 0;
+	s3c_jpeg_release_ion(jpg_reg_ctx);
+
+	if (instanceNo > 0 && --instanceNo == 0)
+		s5p_media_memory_release(S5P_MDEV_JPEG, 0);
 
 	unlock_jpg_mutex();
 	kfree(jpg_reg_ctx);
@@ -242,9 +327,13 @@ static long s3c_jpeg_ioctl(struct file *file,
 				     sizeof(struct jpg_args));
 
 		jpg_reg_ctx->jpg_data_addr = (unsigned int)jpg_data_base_addr;
-		jpg_reg_ctx->img_data_addr =
-			(unsigned int)jpg_data_base_addr
-			+ jpg_reg_ctx->bufinfo->main_frame_start;
+		/* The size of the image is only known once it is decoded */
+		jpg_reg_ctx->img_data_addr = s3c_jpeg_frm_addr(jpg_reg_ctx,
+				jpg_reg_ctx->bufinfo->main_frame_size);
+		if (!jpg_reg_ctx->img_data_addr) {
+			result = FALSE;
+			break;
+		}
 
 		jpeg_clock_enable();
 		result = decode_jpg(jpg_reg_ctx, param.dec_param);
@@ -264,13 +353,21 @@ static long s3c_jpeg_ioctl(struct file *file,
 		jpg_dbg("encode size :: width : %d hegiht : %d\n",
 			param.enc_param->width, param.enc_param->height);
 
+		if (param.enc_param->enc_type == JPG_MAIN) {
+			/* Both input formats take two bytes per pixel */
+			jpg_reg_ctx->img_data_addr = s3c_jpeg_frm_addr(
+				jpg_reg_ctx, param.enc_param->width
+					     * param.enc_param->height * 2);
+			if (!jpg_reg_ctx->img_data_addr) {
+				result = FALSE;
+				break;
+			}
+		}
+
 		jpeg_clock_enable();
 		if (param.enc_param->enc_type == JPG_MAIN) {
 			jpg_reg_ctx->jpg_data_addr =
 					(unsigned int)jpg_data_base_addr;
-			jpg_reg_ctx->img_data_addr =
-				(unsigned int)jpg_data_base_addr
-				+ jpg_reg_ctx->bufinfo->main_frame_start;
 			jpg_dbg("enc_img_data_addr=0x%08x,"
 				"enc_jpg_data_addr=0x%08x\n",
 				jpg_reg_ctx->img_data_addr,
@@ -323,6 +420,12 @@ static long s3c_jpeg_ioctl(struct file *file,
 		unlock_jpg_mutex();
 		return jpg_data_base_addr + jpg_reg_ctx->bufinfo->thumb_frame_start;
 
+	case IOCTL_JPG_SET_ION_FRMBUF:
+		jpg_dbg("IOCTL_JPG_SET_ION_FRMBUF\n");
+		result = s3c_jpeg_import_ion(jpg_reg_ctx,
+					     (struct jpg_ion_buf __user *)arg);
+		break;
+
 	default:
 		jpg_dbg("JPG Invalid ioctl : 0x%X\n", cmd);
 	}
@@ -28,6 +28,7 @@
 #define IOCTL_JPG_GET_THUMB_FRMBUF		_IO(JPEG_IOCTL_MAGIC, 6)
 #define IOCTL_JPG_GET_PHY_FRMBUF		_IO(JPEG_IOCTL_MAGIC, 7)
 #define IOCTL_JPG_GET_PHY_THUMB_FRMBUF		_IO(JPEG_IOCTL_MAGIC, 8)
+#define IOCTL_JPG_SET_ION_FRMBUF		_IO(JPEG_IOCTL_MAGIC, 9)
 #define JPG_CLOCK_DIVIDER_RATIO_QUARTER	4
 
 /* Driver Helper function */
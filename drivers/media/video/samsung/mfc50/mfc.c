@@ -39,6 +39,7 @@
 #include <linux/slab.h>
 #include <linux/clk.h>
 #include <linux/dma-mapping.h>
+#include <linux/pm_qos_params.h>
 
 #include <linux/sched.h>
 #include <linux/firmware.h>
@@ -49,9 +50,6 @@
 #include <plat/media.h>
 #include <mach/media.h>
 #include <plat/mfc.h>
-#ifdef CONFIG_DVFS_LIMIT
-#include <mach/cpu-freq-v210.h>
-#endif
 
 #include "mfc_interface.h"
 #include "mfc_logmsg.h"
@@ -62,12 +60,51 @@
 
 #define MFC_FW_NAME	"samsung_mfc_fw.bin"
 
+/* Keep the CPU at 400MHz and DMC1 at full speed while a codec is open */
+#define MFC_CPU_FREQ_MIN	400000
+#define MFC_BUS_DMC_MIN		200000
+
 static struct resource *mfc_mem;
 static struct mutex mfc_mutex;
 static struct clk *mfc_sclk;
 static struct regulator *mfc_pd_regulator;
+static struct pm_qos_request_list mfc_cpu_qos;
+static struct pm_qos_request_list mfc_bus_qos;
 const struct firmware	*mfc_fw_info;
 
+/*
+ * The buffers may be lent to the page allocator while no instance is
+ * open; take them back before the firmware is loaded into port0.
+ */
+static int mfc_claim_memory(void)
+{
+	int ret;
+
+	ret = s5p_media_memory_claim(S5P_MDEV_MFC, 0);
+	if (ret)
+		return ret;
+
+	ret = s5p_media_memory_claim(S5P_MDEV_MFC, 1);
+	if (ret)
+		s5p_media_memory_release(S5P_MDEV_MFC, 0);
+
+	return ret;
+}
+
+static void mfc_release_memory(void)
+{
+	s5p_media_memory_release(S5P_MDEV_MFC, 1);
+	s5p_media_memory_release(S5P_MDEV_MFC, 0);
+}
+
+static void mfc_qos_release(void)
+{
+	if (pm_qos_request_active(&mfc_cpu_qos))
+		pm_qos_remove_request(&mfc_cpu_qos);
+	if (pm_qos_request_active(&mfc_bus_qos))
+		pm_qos_remove_request(&mfc_bus_qos);
+}
+
 static int mfc_open(struct inode *inode, struct file *file)
 {
 	struct mfc_inst_ctx *mfc_ctx;
@@ -76,17 +113,31 @@ static int mfc_open(struct inode *inode, struct file *file)
 	mutex_lock(&mfc_mutex);
 
 	if (!mfc_is_running()) {
+		if (mfc_fw_info == NULL) {
+			mfc_err("MFC F/W is not loaded\n");
+			ret = -ENODEV;
+			goto err_open;
+		}
+
+		if (mfc_claim_memory()) {
+			mfc_err("MFCINST_MEMORY_ALLOC_FAIL\n");
+			ret = -ENOMEM;
+			goto err_open;
+		}
+
 		/* Turn on mfc power domain regulator */
 		ret = regulator_enable(mfc_pd_regulator);
 		if (ret < 0) {
 			mfc_err("MFC_RET_POWER_ENABLE_FAIL\n");
+			mfc_release_memory();
 			ret = -EINVAL;
 			goto err_open;
 		}
 
-#ifdef CONFIG_DVFS_LIMIT
-		s5pv210_lock_dvfs_high_level(DVFS_LOCK_TOKEN_1, L2);
-#endif
+		pm_qos_add_request_named(&mfc_cpu_qos, PM_QOS_CPU_FREQ_MIN,
+					 MFC_CPU_FREQ_MIN, "mfc");
+		pm_qos_add_request_named(&mfc_bus_qos, PM_QOS_BUS_DMC_MIN,
+					 MFC_BUS_DMC_MIN, "mfc");
 		clk_enable(mfc_sclk);
 
 		mfc_load_firmware(mfc_fw_info->data, mfc_fw_info->size);
@@ -139,13 +190,12 @@ err_mem_inst:
 	kfree(mfc_ctx);
 err_regulator:
 	if (!mfc_is_running()) {
-#ifdef CONFIG_DVFS_LIMIT
-		s5pv210_unlock_dvfs_high_level(DVFS_LOCK_TOKEN_1);
-#endif
+		mfc_qos_release();
 		/* Turn off mfc power domain regulator */
-		ret = regulator_disable(mfc_pd_regulator);
-		if (ret < 0)
+		if (regulator_disable(mfc_pd_regulator) < 0)
 			mfc_err("MFC_RET_POWER_DISABLE_FAIL\n");
+
+		mfc_release_memory();
 	}
 err_open:
 	mutex_unlock(&mfc_mutex);
@@ -168,7 +218,6 @@ static int mfc_release(struct inode *inode, struct file *file)
 	}
 
 	mfc_release_all_buffer(mfc_ctx->mem_inst_no);
-	mfc_merge_fragment(mfc_ctx->mem_inst_no);
 
 	mfc_return_mem_inst_no(mfc_ctx->mem_inst_no);
 
@@ -179,14 +228,17 @@ static int mfc_release(struct inode *inode, struct file *file)
 		clk_disable(mfc_sclk);
 	}
 
+	/* The codec instance is gone, it no longer writes the DPBs */
+	mfc_release_dpb_ion(mfc_ctx);
+
 	kfree(mfc_ctx);
 
 	ret = 0;
 
 	if (!mfc_is_running()) {
-#ifdef CONFIG_DVFS_LIMIT
-		s5pv210_unlock_dvfs_high_level(DVFS_LOCK_TOKEN_1);
-#endif
+		mfc_qos_release();
+		mfc_release_memory();
+
 		/* Turn off mfc power domain regulator */
 		ret = regulator_disable(mfc_pd_regulator);
 		if (ret < 0) {
@@ -527,8 +579,11 @@ static struct miscdevice mfc_miscdev = {
 static void mfc_firmware_request_complete_handler(const struct firmware *fw,
 						  void *context)
 {
+	/*
+	 * port0 may be lent to the page allocator at this point, the
+	 * firmware is copied in by mfc_open() once the memory is claimed.
+	 */
 	if (fw != NULL) {
-		mfc_load_firmware(fw->data, fw->size);
 		mfc_fw_info = fw;
 	} else {
 		mfc_err("failed to load MFC F/W, MFC will not working\n");
@@ -29,6 +29,9 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/rbtree.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <linux/io.h>
 #include <linux/uaccess.h>
@@ -41,21 +44,165 @@
 #include "mfc_logmsg.h"
 #include "mfc_memory.h"
 
-static struct list_head mfc_alloc_mem_head[MFC_MAX_PORT_NUM];
-static struct list_head mfc_free_mem_head[MFC_MAX_PORT_NUM];
+/*
+ * Free space of each port is kept in two trees over the same nodes: one
+ * ordered by address so a released buffer finds its neighbours and merges
+ * with them at once, whichever instance owned them, and one ordered by
+ * (size, address) so the best fitting chunk is found without a scan.
+ */
+struct mfc_port_mem {
+	struct list_head alloc_head;
+	struct rb_root free_by_addr;
+	struct rb_root free_by_size;
+	unsigned int base;
+	unsigned int size;
+	unsigned int used;
+	unsigned int peak_used;
+	unsigned int free_chunks;
+	unsigned int alloc_fail;
+};
+
+static struct mfc_port_mem mfc_port_mem[MFC_MAX_PORT_NUM];
+static DEFINE_MUTEX(mfc_buf_lock);
+
+static void mfc_free_insert_size(struct mfc_port_mem *port,
+				 struct mfc_free_mem *node)
+{
+	struct rb_node **p = &port->free_by_size.rb_node;
+	struct rb_node *parent = NULL;
+	struct mfc_free_mem *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct mfc_free_mem, size_node);
+		if (node->size < entry->size ||
+		    (node->size == entry->size &&
+		     node->start_addr < entry->start_addr))
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
 
-void mfc_print_mem_list(void)
+	rb_link_node(&node->size_node, parent, p);
+	rb_insert_color(&node->size_node, &port->free_by_size);
+}
+
+static void mfc_free_insert(struct mfc_port_mem *port,
+			    struct mfc_free_mem *node)
+{
+	struct rb_node **p = &port->free_by_addr.rb_node;
+	struct rb_node *parent = NULL;
+	struct mfc_free_mem *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct mfc_free_mem, addr_node);
+		if (node->start_addr < entry->start_addr)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&node->addr_node, parent, p);
+	rb_insert_color(&node->addr_node, &port->free_by_addr);
+
+	mfc_free_insert_size(port, node);
+	port->free_chunks++;
+}
+
+static void mfc_free_erase(struct mfc_port_mem *port,
+			   struct mfc_free_mem *node)
+{
+	rb_erase(&node->addr_node, &port->free_by_addr);
+	rb_erase(&node->size_node, &port->free_by_size);
+	port->free_chunks--;
+	kfree(node);
+}
+
+/*
+ * Free chunks never overlap, so moving the start or end of one keeps its
+ * place in the address tree; only the size tree has to be rekeyed.
+ */
+static void mfc_free_resize(struct mfc_port_mem *port,
+			    struct mfc_free_mem *node)
+{
+	rb_erase(&node->size_node, &port->free_by_size);
+	mfc_free_insert_size(port, node);
+}
+
+static struct mfc_free_mem *mfc_free_best_fit(struct mfc_port_mem *port,
+					      unsigned int size)
+{
+	struct rb_node *n = port->free_by_size.rb_node;
+	struct mfc_free_mem *entry, *best = NULL;
+
+	while (n) {
+		entry = rb_entry(n, struct mfc_free_mem, size_node);
+		if (entry->size >= size) {
+			best = entry;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return best;
+}
+
+static void mfc_free_neighbours(struct mfc_port_mem *port, unsigned int addr,
+				struct mfc_free_mem **prev,
+				struct mfc_free_mem **next)
+{
+	struct rb_node *n = port->free_by_addr.rb_node;
+	struct mfc_free_mem *entry;
+
+	*prev = NULL;
+	*next = NULL;
+
+	while (n) {
+		entry = rb_entry(n, struct mfc_free_mem, addr_node);
+		if (addr < entry->start_addr) {
+			*next = entry;
+			n = n->rb_left;
+		} else {
+			*prev = entry;
+			n = n->rb_right;
+		}
+	}
+}
+
+static unsigned int mfc_largest_free(struct mfc_port_mem *port)
 {
-	struct list_head *pos;
+	struct rb_node *n = rb_last(&port->free_by_size);
+
+	return n ? rb_entry(n, struct mfc_free_mem, size_node)->size : 0;
+}
+
+/* Percentage of free space that is not usable by the largest request */
+static unsigned int mfc_fragmentation(struct mfc_port_mem *port)
+{
+	unsigned int free = port->size - port->used;
+
+	if (!free)
+		return 0;
+
+	return 100 - (unsigned int)div_u64((u64)mfc_largest_free(port) * 100,
+					   free);
+}
+
+static void mfc_dump_mem_list(void)
+{
+	struct mfc_port_mem *port;
 	struct mfc_alloc_mem *alloc_node;
 	struct mfc_free_mem *free_node;
+	struct rb_node *n;
 	int port_no;
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		port = &mfc_port_mem[port_no];
+
 		mfc_info("===== %s port%d list =====\n", __func__,  port_no);
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
-		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
+		list_for_each_entry(alloc_node, &port->alloc_head, list) {
 			mfc_info("[alloc_list] inst_no: %d, p_addr: 0x%08x, "
 					"u_addr: 0x%p, size: %d\n",
 					alloc_node->inst_no,
@@ -64,117 +211,193 @@ void mfc_print_mem_list(void)
 					alloc_node->size);
 		}
 
-		list_for_each(pos, &mfc_free_mem_head[port_no])
-		{
-			free_node = list_entry(pos, struct mfc_free_mem, list);
+		for (n = rb_first(&port->free_by_addr); n; n = rb_next(n)) {
+			free_node = rb_entry(n, struct mfc_free_mem, addr_node);
 			mfc_info("[free_list] start_addr: 0x%08x size:%d\n",
 					free_node->start_addr , free_node->size);
 		}
 	}
 }
 
-void mfc_merge_fragment(int inst_no)
+void mfc_print_mem_list(void)
 {
-	struct list_head *pos, *n;
-	struct mfc_free_mem *node1, *node2;
-	int port_no;
+	mutex_lock(&mfc_buf_lock);
+	mfc_dump_mem_list();
+	mutex_unlock(&mfc_buf_lock);
+}
 
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_free_mem_head[port_no])
-		{
-			node1 = list_entry(pos, struct mfc_free_mem, list);
-			node2 = list_entry(n, struct mfc_free_mem, list);
-			if ((node1->start_addr + node1->size) == node2->start_addr) {
-				node2->start_addr = node1->start_addr;
-				node2->size += node1->size;
-				list_del(&(node1->list));
-				kfree(node1);
-			}
-		}
+static unsigned int mfc_get_free_mem(int alloc_size, int inst_no, int port_no)
+{
+	struct mfc_port_mem *port = &mfc_port_mem[port_no];
+	struct mfc_free_mem *match_node;
+	unsigned int alloc_addr;
+
+	mfc_debug("request Size : %d\n", alloc_size);
+
+	if (alloc_size <= 0)
+		return 0;
+
+	match_node = mfc_free_best_fit(port, alloc_size);
+	if (!match_node) {
+		port->alloc_fail++;
+		mfc_err("no chunk for %d bytes on port%d: free %u, "
+			"largest %u in %u chunks\n", alloc_size, port_no,
+			port->size - port->used, mfc_largest_free(port),
+			port->free_chunks);
+		return 0;
 	}
 
-#if defined(DEBUG)
-	mfc_print_mem_list();
-#endif
-}
+	mfc_debug("match : startAddr(0x%08x) size(%d)\n",
+			match_node->start_addr, match_node->size);
+
+	alloc_addr = match_node->start_addr;
+	if (match_node->size == alloc_size) {
+		mfc_free_erase(port, match_node);
+	} else {
+		match_node->start_addr += alloc_size;
+		match_node->size -= alloc_size;
+		mfc_free_resize(port, match_node);
+	}
 
+	port->used += alloc_size;
+	if (port->used > port->peak_used)
+		port->peak_used = port->used;
 
+	return alloc_addr;
+}
 
-static unsigned int mfc_get_free_mem(int alloc_size, int inst_no, int port_no)
+static void mfc_put_free_mem(unsigned int addr, unsigned int size,
+			     int port_no)
 {
-	struct list_head *pos;
-	struct mfc_free_mem *free_node, *match_node = NULL;
-	unsigned int alloc_addr = 0;
+	struct mfc_port_mem *port = &mfc_port_mem[port_no];
+	struct mfc_free_mem *prev, *next, *node = NULL;
 
-	mfc_debug("request Size : %d\n", alloc_size);
+	port->used -= size;
+
+	mfc_free_neighbours(port, addr, &prev, &next);
 
-	if (list_empty(&mfc_free_mem_head[port_no])) {
-		mfc_err("all memory is gone\n");
-		return alloc_addr;
+	if (prev && prev->start_addr + prev->size == addr) {
+		prev->size += size;
+		node = prev;
 	}
-	/* find best chunk of memory */
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		free_node = list_entry(pos, struct mfc_free_mem, list);
-
-		if (match_node != NULL) {
-			if ((free_node->size >= alloc_size) &&
-				(free_node->size < match_node->size))
-				match_node = free_node;
+
+	if (next && addr + size == next->start_addr) {
+		if (node) {
+			node->size += next->size;
+			mfc_free_erase(port, next);
 		} else {
-			if (free_node->size >= alloc_size)
-				match_node = free_node;
+			next->start_addr = addr;
+			next->size += size;
+			node = next;
 		}
 	}
 
+	if (node) {
+		mfc_free_resize(port, node);
+		return;
+	}
 
-	if (match_node != NULL) {
-		mfc_debug("match : startAddr(0x%08x) size(%d)\n", match_node->start_addr, match_node->size);
+	node = kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
+	if (!node) {
+		mfc_err("lost 0x%08x (%u bytes) on port%d\n",
+				addr, size, port_no);
+		return;
+	}
 
-		alloc_addr = match_node->start_addr;
-		match_node->start_addr += alloc_size;
-		match_node->size -= alloc_size;
+	node->start_addr = addr;
+	node->size = size;
+	mfc_free_insert(port, node);
+}
 
-		if (match_node->size < 0x1)	/* delete match_node. */
-			mfc_err("there is no suitable chunk...[case 0]\n");
-	} else {
-		mfc_err("there is no suitable chunk....[case 1]\n");
-		return 0;
+static void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
+{
+	mfc_put_free_mem(alloc_node->p_addr, alloc_node->size, port_no);
+
+	list_del(&(alloc_node->list));
+	kfree(alloc_node);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static int mfc_mem_stats_show(struct seq_file *s, void *unused)
+{
+	struct mfc_port_mem *port;
+	int port_no;
+
+	mutex_lock(&mfc_buf_lock);
+	seq_printf(s, "port       size       used       peak    largest  "
+			"chunks  frag%%  fails\n");
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		port = &mfc_port_mem[port_no];
+		seq_printf(s, "%4d %10u %10u %10u %10u %7u %6u %6u\n",
+				port_no, port->size, port->used,
+				port->peak_used, mfc_largest_free(port),
+				port->free_chunks, mfc_fragmentation(port),
+				port->alloc_fail);
 	}
+	mutex_unlock(&mfc_buf_lock);
 
-	return alloc_addr;
+	return 0;
 }
 
+static int mfc_mem_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mfc_mem_stats_show, inode->i_private);
+}
+
+static const struct file_operations mfc_mem_stats_fops = {
+	.open		= mfc_mem_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void mfc_mem_stats_init(void)
+{
+	debugfs_create_file("mfc_memory", S_IRUGO, NULL, NULL,
+			    &mfc_mem_stats_fops);
+}
+#else
+static inline void mfc_mem_stats_init(void) { }
+#endif
 
 int mfc_init_buffer(void)
 {
+	struct mfc_port_mem *port;
 	struct mfc_free_mem *free_node;
 	int	port_no;
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		INIT_LIST_HEAD(&mfc_alloc_mem_head[port_no]);
-		INIT_LIST_HEAD(&mfc_free_mem_head[port_no]);
-		/* init free head node */
-		free_node =
-			(struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-		memset(free_node, 0x00, sizeof(struct mfc_free_mem));
+		port = &mfc_port_mem[port_no];
+
+		INIT_LIST_HEAD(&port->alloc_head);
+		port->free_by_addr = RB_ROOT;
+		port->free_by_size = RB_ROOT;
 
 		if (port_no) {
-			free_node->start_addr = mfc_get_port1_buff_paddr();
-			free_node->size = mfc_port1_memsize;
+			port->base = mfc_get_port1_buff_paddr();
+			port->size = mfc_port1_memsize;
 		} else {
-			free_node->start_addr = mfc_get_port0_buff_paddr();
+			port->base = mfc_get_port0_buff_paddr();
 #ifdef CONFIG_S5P_HUGEMEM
-			free_node->size = mfc_port1_memsize -
+			port->size = mfc_port1_memsize -
 #else
-			free_node->size = mfc_port0_memsize -
+			port->size = mfc_port0_memsize -
 #endif
 				(mfc_get_port0_buff_paddr() - mfc_get_fw_buff_paddr());
 		}
 
-		list_add_tail(&(free_node->list), &mfc_free_mem_head[port_no]);
+		/* init free head node */
+		free_node = kzalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
+		if (!free_node)
+			return -ENOMEM;
+
+		free_node->start_addr = port->base;
+		free_node->size = port->size;
+		mfc_free_insert(port, free_node);
 	}
 
+	mfc_mem_stats_init();
+
 #if defined(DEBUG)
 	mfc_print_mem_list();
 #endif
@@ -183,15 +406,15 @@ int mfc_init_buffer(void)
 
 enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 {
-	struct list_head *pos;
 	int port_no;
 	struct mfc_alloc_mem *alloc_node;
 	bool found = false;
 
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
-		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
+	mutex_lock(&mfc_buf_lock);
+
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM && !found; port_no++) {
+		list_for_each_entry(alloc_node,
+				&mfc_port_mem[port_no].alloc_head, list) {
 			if (alloc_node->u_addr == u_addr) {
 				mfc_free_alloc_mem(alloc_node, port_no);
 				found = true;
@@ -201,9 +424,11 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 	}
 
 #if defined(DEBUG)
-	mfc_print_mem_list();
+	mfc_dump_mem_list();
 #endif
 
+	mutex_unlock(&mfc_buf_lock);
+
 	if (found)
 		return MFCINST_RET_OK;
 	else
@@ -212,62 +437,39 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 
 void mfc_release_all_buffer(int inst_no)
 {
-	struct list_head *pos, *n;
 	int port_no;
-	struct mfc_alloc_mem *alloc_node;
+	struct mfc_alloc_mem *alloc_node, *n;
+
+	mutex_lock(&mfc_buf_lock);
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_alloc_mem_head[port_no]) {
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			if (alloc_node->inst_no == inst_no) {
+		list_for_each_entry_safe(alloc_node, n,
+				&mfc_port_mem[port_no].alloc_head, list) {
+			if (alloc_node->inst_no == inst_no)
 				mfc_free_alloc_mem(alloc_node, port_no);
-			}
 		}
 	}
 
 #if defined(DEBUG)
-	mfc_print_mem_list();
+	mfc_dump_mem_list();
 #endif
-}
-
-void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
-{
-	struct list_head *pos;
-	struct mfc_free_mem *free_node;
-	struct mfc_free_mem *target_node;
-
-	free_node = (struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-	free_node->start_addr = alloc_node->p_addr;
-	free_node->size = alloc_node->size;
-
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		target_node = list_entry(pos, struct mfc_free_mem, list);
-		if (alloc_node->p_addr < target_node->start_addr)
-			break;
-	}
-
-	if (pos == &mfc_free_mem_head[port_no])
-		list_add_tail(&(free_node->list), &(mfc_free_mem_head[port_no]));
-	else
-		list_add_tail(&(free_node->list), pos);
 
-	list_del(&(alloc_node->list));
-	kfree(alloc_node);
+	mutex_unlock(&mfc_buf_lock);
 }
 
 enum mfc_error_code mfc_get_phys_addr(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
 {
 	int ret, port_no;
-	struct list_head *pos;
 	struct mfc_alloc_mem *alloc_node;
 	struct mfc_get_phys_addr_arg *phys_addr_arg;
 
 	phys_addr_arg = (struct mfc_get_phys_addr_arg *)args;
+
+	mutex_lock(&mfc_buf_lock);
+
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each(pos, &mfc_alloc_mem_head[port_no])
-		{
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
+		list_for_each_entry(alloc_node,
+				&mfc_port_mem[port_no].alloc_head, list) {
 			if (alloc_node->u_addr == (unsigned char *)phys_addr_arg->u_addr) {
 				mfc_debug("u_addr(0x%08x), p_addr(0x%08x) is found\n",
 						alloc_node->u_addr, alloc_node->p_addr);
@@ -285,6 +487,7 @@ found:
 	ret = MFCINST_RET_OK;
 
 out_getphysaddr:
+	mutex_unlock(&mfc_buf_lock);
 	return ret;
 }
 
@@ -306,6 +509,8 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 	}
 	memset(alloc_node, 0x00, sizeof(struct mfc_alloc_mem));
 
+	mutex_lock(&mfc_buf_lock);
+
 	/* if user request area, allocate from reserved area */
 	start_paddr = mfc_get_free_mem((int)in_param->buff_size, inst_no, port_no);
 	mfc_debug("start_paddr = 0x%X\n\r", start_paddr);
@@ -315,7 +520,7 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 		in_param->out_uaddr = -1;
 		ret = MFCINST_MEMORY_ALLOC_FAIL;
 		kfree(alloc_node);
-		goto out_getcodecviraddr;
+		goto out_unlock;
 	}
 
 	alloc_node->p_addr = start_paddr;
@@ -342,13 +547,15 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 	alloc_node->size = (int)in_param->buff_size;
 	alloc_node->inst_no = inst_no;
 
-	list_add(&(alloc_node->list), &mfc_alloc_mem_head[port_no]);
+	list_add(&(alloc_node->list), &mfc_port_mem[port_no].alloc_head);
 	ret = MFCINST_RET_OK;
 
 #if defined(DEBUG)
-	mfc_print_mem_list();
+	mfc_dump_mem_list();
 #endif
 
+out_unlock:
+	mutex_unlock(&mfc_buf_lock);
 out_getcodecviraddr:
 	return ret;
 }
@@ -100,7 +100,8 @@ enum  ssbsip_mfc_dec_conf {
 	MFC_DEC_GETCONF_CRC_DATA,
 	MFC_DEC_GETCONF_BUF_WIDTH_HEIGHT,
 	FC_DEC_GETCONF_CROP_INFO,
-	MFC_DEC_GETCONF_FRAME_TAG
+	MFC_DEC_GETCONF_FRAME_TAG,
+	MFC_DEC_SETCONF_DPB_ION		/* [0]: ion fd, -1 to drop, [1]: chroma offset */
 };
 
 enum  ssbsip_mfc_enc_conf {
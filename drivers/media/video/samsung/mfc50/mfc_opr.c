@@ -40,7 +40,9 @@
 #include <plat/regs-mfc.h>
 #include <asm/cacheflush.h>
 #include <mach/map.h>
+#include <mach/media.h>
 #include <plat/map-s5p.h>
+#include <plat/ion.h>
 
 #include "mfc_opr.h"
 #include "mfc_logmsg.h"
@@ -262,6 +264,113 @@ static void mfc_set_dec_stream_buffer(struct mfc_inst_ctx *mfc_ctx, int buf_addr
 	mfc_debug_L0("stream_paddr: 0x%08x, desc_paddr: 0x%08x\n", buf_addr, buf_addr + CPB_BUF_SIZE);
 }
 
+static struct ion_client *mfc_ion_client;
+
+void mfc_release_dpb_ion(struct mfc_inst_ctx *mfc_ctx)
+{
+	if (mfc_ctx->dpb_ion) {
+		s5p_ion_free(mfc_ion_client, mfc_ctx->dpb_ion);
+		mfc_ctx->dpb_ion = NULL;
+	}
+}
+
+/*
+ * Decode into a shared ion buffer instead of the MFC carveout, so FIMC and
+ * the overlay can take the frames by fd. Luma (and the H.264 MV planes) are
+ * laid out from offset 0, chroma from chroma_offset. The windows are only
+ * checked at DEC_INIT, once the DPB sizes are known.
+ */
+static enum mfc_error_code mfc_import_dpb_ion(struct mfc_inst_ctx *mfc_ctx, int fd, unsigned int chroma_offset)
+{
+	struct ion_handle *handle;
+	dma_addr_t paddr;
+	size_t size;
+
+	mfc_release_dpb_ion(mfc_ctx);
+
+	/* A negative fd goes back to the MFC carveout */
+	if (fd < 0)
+		return MFCINST_RET_OK;
+
+	if (chroma_offset & ((1 << 11) - 1)) {
+		mfc_err("DPB_ION : chroma offset 0x%x is not 2KB aligned\n", chroma_offset);
+		return MFCINST_ERR_INVALID_PARAM;
+	}
+
+	if (!mfc_ion_client) {
+		struct ion_client *client = s5p_ion_client_create("mfc");
+
+		if (IS_ERR(client)) {
+			mfc_err("DPB_ION : no ion device\n");
+			return MFCINST_ERR_SET_CONF;
+		}
+		mfc_ion_client = client;
+	}
+
+	handle = s5p_ion_import_fd(mfc_ion_client, fd, &paddr, &size);
+	if (IS_ERR(handle)) {
+		mfc_err("DPB_ION : cannot import fd %d\n", fd);
+		return MFCINST_ERR_FRM_BUF_INVALID;
+	}
+
+	mfc_ctx->dpb_ion = handle;
+	mfc_ctx->dpb_ion_paddr = paddr;
+	mfc_ctx->dpb_ion_size = size;
+	mfc_ctx->dpb_ion_chroma_offset = chroma_offset;
+
+	return MFCINST_RET_OK;
+}
+
+/*
+ * The DPB registers hold 2KB units from the port's DRAM base, so every
+ * plane has to sit inside the S5P_RANGE_MFC window above it.
+ */
+static bool mfc_in_port_window(unsigned int addr, unsigned int size, unsigned int port_base_paddr)
+{
+	if (addr & ((1 << 11) - 1))
+		return false;
+
+	return (addr >= port_base_paddr) && (addr + size >= addr) &&
+	       (addr + size <= port_base_paddr + S5P_RANGE_MFC);
+}
+
+static enum mfc_error_code mfc_set_dec_dpb_ion(struct mfc_inst_ctx *mfc_ctx, struct mfc_dec_init_arg *init_arg,
+					       unsigned int luma_size, unsigned int chroma_size)
+{
+	unsigned int luma_paddr, chroma_paddr;
+
+	if ((mfc_ctx->dpb_ion_chroma_offset < luma_size) ||
+	    (chroma_size > mfc_ctx->dpb_ion_size) ||
+	    (mfc_ctx->dpb_ion_chroma_offset > mfc_ctx->dpb_ion_size - chroma_size)) {
+		mfc_err("DPB_ION : %u bytes can not hold luma %u + chroma %u at 0x%x\n",
+			mfc_ctx->dpb_ion_size, luma_size, chroma_size, mfc_ctx->dpb_ion_chroma_offset);
+		return MFCINST_ERR_FRM_BUF_SIZE;
+	}
+
+	luma_paddr = mfc_ctx->dpb_ion_paddr;
+	chroma_paddr = mfc_ctx->dpb_ion_paddr + mfc_ctx->dpb_ion_chroma_offset;
+
+	/* Luma and MV are fetched through port1, chroma through port0 */
+	if (!mfc_in_port_window(luma_paddr, luma_size, mfc_port1_base_paddr) ||
+	    !mfc_in_port_window(chroma_paddr, chroma_size, mfc_port0_base_paddr)) {
+		mfc_err("DPB_ION : luma 0x%08x or chroma 0x%08x is out of the MFC ports\n",
+			luma_paddr, chroma_paddr);
+		return MFCINST_ERR_FRM_BUF_INVALID;
+	}
+
+	/* Userspace maps the ion buffer itself, not the MFC device */
+	init_arg->out_frame_buf_size.luma = luma_size;
+	init_arg->out_frame_buf_size.chroma = chroma_size;
+	init_arg->out_u_addr.luma = 0;
+	init_arg->out_u_addr.chroma = 0;
+	init_arg->out_p_addr.luma = luma_paddr;
+	init_arg->out_p_addr.chroma = chroma_paddr;
+
+	mfc_ctx->dec_dpb_buff_paddr = init_arg->out_p_addr;
+
+	return MFCINST_RET_OK;
+}
+
 static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
 {
 	struct mfc_dec_init_arg *init_arg;
@@ -297,6 +406,9 @@ static enum mfc_error_code mfc_alloc_dec_frame_buffer(struct mfc_inst_ctx *mfc_c
 	luma_size = buf_size.luma * mfc_ctx->totalDPBCnt;
 	chroma_size = buf_size.chroma * mfc_ctx->totalDPBCnt;
 
+	if (mfc_ctx->dpb_ion)
+		return mfc_set_dec_dpb_ion(mfc_ctx, init_arg, luma_size, chroma_size);
+
 	/*
 	 * Allocate chroma & (Mv in case of H264) buf
 	 */
@@ -1893,6 +2005,15 @@ enum mfc_error_code mfc_set_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 		mfc_ctx->heightFIMV1 = set_cnf_arg->in_config_value[1];
 		break;
 
+	case MFC_DEC_SETCONF_DPB_ION:
+		if (mfc_ctx->MfcState >= MFCINST_STATE_DEC_INITIALIZE) {
+			mfc_err("MFC_DEC_SETCONF_DPB_ION : state is invalid\n");
+			return MFCINST_ERR_STATE_INVALID;
+		}
+
+		return mfc_import_dpb_ion(mfc_ctx, set_cnf_arg->in_config_value[0],
+					  set_cnf_arg->in_config_value[1]);
+
 	case MFC_ENC_SETCONF_FRAME_TYPE:
 		if (mfc_ctx->MfcState != MFCINST_STATE_ENC_EXE) {
 			mfc_err("MFC_ENC_SETCONF_FRAME_TYPE : state is invalid\n");
@@ -26,6 +26,8 @@
 #include "mfc_interface.h"
 #include "mfc_shared_mem.h"
 
+struct ion_handle;
+
 #define MFC_WARN_START_NO		145
 #define MFC_ERR_START_NO			1
 
@@ -176,6 +178,10 @@ struct mfc_inst_ctx {
 	struct mfc_shared_mem shared_mem;
 	enum mfc_buffer_type buf_type;
 	unsigned int desc_buff_paddr;
+	struct ion_handle *dpb_ion;	/* DPBs imported by MFC_DEC_SETCONF_DPB_ION */
+	unsigned int dpb_ion_paddr;
+	unsigned int dpb_ion_size;
+	unsigned int dpb_ion_chroma_offset;
 };
 
 int mfc_load_firmware(const unsigned char *data, size_t size);
@@ -189,6 +195,7 @@ enum mfc_error_code mfc_exe_decode(struct mfc_inst_ctx *mfc_ctx, union mfc_args
 enum mfc_error_code mfc_get_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 enum mfc_error_code mfc_set_config(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args);
 enum mfc_error_code mfc_deinit_hw(struct mfc_inst_ctx *mfc_ctx);
+void mfc_release_dpb_ion(struct mfc_inst_ctx *mfc_ctx);
 enum mfc_error_code mfc_set_sleep(void);
 enum mfc_error_code mfc_set_wakeup(void);
 
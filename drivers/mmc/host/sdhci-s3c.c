@@ -533,7 +533,25 @@ static int __devinit sdhci_s3c_probe(struct platform_device *pdev)
 	if (pdata->must_maintain_clock)
 		host->quirks |= SDHCI_QUIRK_MUST_MAINTAIN_CLOCK;
 
-#ifndef CONFIG_MMC_SDHCI_S3C_DMA
+#ifdef CONFIG_MMC_SDHCI_S3C_DMA
+
+	/* The HSMMC blocks have an ADMA2 engine even where the
+	 * capabilities register leaves it out. Advertise it so that
+	 * scatter-gather transfers run from a descriptor chain instead
+	 * of stopping at every SDMA boundary; SDMA stays as fallback. */
+	host->caps = readl(host->ioaddr + SDHCI_CAPABILITIES) |
+		     SDHCI_CAN_DO_ADMA2;
+	host->quirks |= SDHCI_QUIRK_MISSING_CAPS;
+
+	/* Zero length descriptors are not taken as 64KiB */
+	host->quirks |= SDHCI_QUIRK_BROKEN_ADMA_ZEROLEN_DESC;
+
+	/* On a data error the DMA keeps running and overruns into the
+	 * following memory; the data line must be reset before the
+	 * buffers are given back. */
+	host->quirks |= SDHCI_QUIRK_DMA_RESET_ON_ERROR;
+
+#else
 
 	/* we currently see overruns on errors, so disable the SDMA
 	 * support as well. */
@@ -440,6 +440,52 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
+static int sdhci_data_dir(struct mmc_data *data)
+{
+	return (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+}
+
+/*
+ * Map the data for DMA. With @next set this is done from pre_req() for a
+ * request that has not been started yet, and the data is tagged with a
+ * cookie. When the request is started, data carrying the current cookie
+ * reuses that mapping instead of mapping it again.
+ */
+static int sdhci_pre_dma_transfer(struct sdhci_host *host,
+	struct mmc_data *data, struct sdhci_next *next)
+{
+	int sg_count;
+
+	if (!next && data->host_cookie &&
+	    data->host_cookie != host->next_data.cookie) {
+		printk(KERN_WARNING "%s: invalid cookie %d, next %d\n",
+			mmc_hostname(host->mmc), data->host_cookie,
+			host->next_data.cookie);
+		data->host_cookie = 0;
+	}
+
+	if (next || !data->host_cookie) {
+		sg_count = dma_map_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, sdhci_data_dir(data));
+	} else {
+		sg_count = host->next_data.sg_count;
+		host->next_data.sg_count = 0;
+	}
+
+	if (sg_count == 0)
+		return -EINVAL;
+
+	if (next) {
+		next->sg_count = sg_count;
+		data->host_cookie = ++next->cookie < 0 ? 1 : next->cookie;
+		next->cookie = data->host_cookie;
+	} else {
+		host->sg_count = sg_count;
+	}
+
+	return sg_count;
+}
+
 static int sdhci_adma_table_pre(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -477,9 +523,7 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
-	if (host->sg_count == 0)
+	if (sdhci_pre_dma_transfer(host, data, NULL) < 0)
 		goto unmap_align;
 
 	desc = host->adma_desc;
@@ -568,8 +612,9 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
 		128 * 4, direction);
@@ -600,27 +645,44 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		128 * 4, direction);
 
 	if (data->flags & MMC_DATA_READ) {
-		dma_sync_sg_for_cpu(mmc_dev(host->mmc), data->sg,
-			data->sg_len, direction);
-
-		align = host->align_buffer;
+		bool has_unaligned = false;
 
+		/*
+		 * Only sync the data for the CPU when the align bytes have
+		 * to be copied back; a premapped sg list is otherwise left
+		 * for post_req() to unmap.
+		 */
 		for_each_sg(data->sg, sg, host->sg_count, i) {
 			if (sg_dma_address(sg) & 0x3) {
-				size = 4 - (sg_dma_address(sg) & 0x3);
+				has_unaligned = true;
+				break;
+			}
+		}
 
-				buffer = sdhci_kmap_atomic(sg, &flags);
-				WARN_ON(((long)buffer & PAGE_MASK) > (PAGE_SIZE - 3));
-				memcpy(buffer, align, size);
-				sdhci_kunmap_atomic(buffer, &flags);
+		if (has_unaligned) {
+			dma_sync_sg_for_cpu(mmc_dev(host->mmc), data->sg,
+				data->sg_len, direction);
 
-				align += 4;
+			align = host->align_buffer;
+
+			for_each_sg(data->sg, sg, host->sg_count, i) {
+				if (sg_dma_address(sg) & 0x3) {
+					size = 4 - (sg_dma_address(sg) & 0x3);
+
+					buffer = sdhci_kmap_atomic(sg, &flags);
+					WARN_ON(((long)buffer & PAGE_MASK) > (PAGE_SIZE - 3));
+					memcpy(buffer, align, size);
+					sdhci_kunmap_atomic(buffer, &flags);
+
+					align += 4;
+				}
 			}
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_command *cmd)
@@ -802,12 +864,8 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
-					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
-			if (sg_cnt == 0) {
+			sg_cnt = sdhci_pre_dma_transfer(host, data, NULL);
+			if (sg_cnt <= 0) {
 				/*
 				 * This only happens when someone fed
 				 * us an invalid request.
@@ -841,6 +899,13 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 	if (!(host->flags & SDHCI_REQ_USE_DMA)) {
 		int flags;
 
+		/* Data premapped by pre_req() must not be touched by PIO */
+		if (data->host_cookie) {
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				data->sg_len, sdhci_data_dir(data));
+			data->host_cookie = 0;
+		}
+
 		flags = SG_MITER_ATOMIC;
 		if (host->data->flags & MMC_DATA_READ)
 			flags |= SG_MITER_TO_SG;
@@ -901,13 +966,20 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	data = host->data;
 	host->data = NULL;
 
+	/*
+	 * Stop the DMA engine before its buffers are unmapped and handed
+	 * back, rather than leaving that to the reset in the tasklet.
+	 */
+	if (data->error && (host->flags & SDHCI_REQ_USE_DMA) &&
+	    (host->quirks & SDHCI_QUIRK_DMA_RESET_ON_ERROR))
+		sdhci_reset(host, SDHCI_RESET_DATA);
+
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-				data->sg_len, (data->flags & MMC_DATA_READ) ?
-					DMA_FROM_DEVICE : DMA_TO_DEVICE);
+				data->sg_len, sdhci_data_dir(data));
 		}
 	}
 
@@ -1862,7 +1934,42 @@ void sdhci_adjust_cfg(struct mmc_host *mmc, int rw)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+
+	if (!mrq->data)
+		return;
+
+	if (mrq->data->host_cookie) {
+		mrq->data->host_cookie = 0;
+		return;
+	}
+
+	if (host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA))
+		if (sdhci_pre_dma_transfer(host, mrq->data,
+					   &host->next_data) < 0)
+			mrq->data->host_cookie = 0;
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		sdhci_data_dir(data));
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
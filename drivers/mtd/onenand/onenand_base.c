@@ -1312,6 +1312,80 @@ static int onenand_read_ops_nolock(struct mtd_info *mtd, loff_t from,
 	return mtd->ecc_stats.corrected - stats.corrected ? -EUCLEAN : 0;
 }
 
+/**
+ * onenand_rwl_read_oob - [GENERIC] Read out-of-band with read-while-load
+ * @param mtd		MTD device structure
+ * @param from		offset to read from
+ * @param buf		buffer to read into
+ * @param len		number of bytes to read
+ * @param column	offset into the spare area of the first page
+ * @param oobsize	usable spare area size per page
+ * @param mode		oob operation mode
+ * @param retlen	pointer to variable to store the number of read bytes
+ *
+ * Load the next page into the other DataRAM while the spare area
+ * of the current one is copied out, like onenand_read_ops_nolock.
+ */
+static int onenand_rwl_read_oob(struct mtd_info *mtd, loff_t from,
+		u_char *buf, size_t len, int column, int oobsize,
+		mtd_oob_mode_t mode, int *retlen)
+{
+	struct onenand_chip *this = mtd->priv;
+	int read = 0, thislen;
+	int ret, boundary = 0;
+
+	/* Do first load to bufferRAM */
+	this->command(mtd, ONENAND_CMD_READOOB, from, mtd->oobsize);
+	onenand_update_bufferram(mtd, from, 0);
+	ret = this->wait(mtd, FL_READING);
+
+	while (!ret || ret == -EBADMSG) {
+		thislen = oobsize - column;
+		thislen = min_t(int, thislen, len - read);
+
+		/* If there is more to load then start next load */
+		if (read + thislen < len) {
+			from += mtd->writesize;
+			this->command(mtd, ONENAND_CMD_READOOB, from, mtd->oobsize);
+			/* Chip boundary handling in DDP */
+			if (ONENAND_IS_DDP(this) &&
+			    unlikely(from == (this->chipsize >> 1))) {
+				this->write_word(ONENAND_DDP_CHIP0, this->base + ONENAND_REG_START_ADDRESS2);
+				boundary = 1;
+			} else
+				boundary = 0;
+			ONENAND_SET_PREV_BUFFERRAM(this);
+		}
+
+		/* While load is going, read from last bufferRAM */
+		if (mode == MTD_OOB_AUTO)
+			onenand_transfer_auto_oob(mtd, buf, column, thislen);
+		else
+			this->read_bufferram(mtd, ONENAND_SPARERAM, buf, column, thislen);
+
+		read += thislen;
+		if (read == len)
+			break;
+
+		/* Set up for next read from bufferRAM */
+		if (unlikely(boundary))
+			this->write_word(ONENAND_DDP_CHIP1, this->base + ONENAND_REG_START_ADDRESS2);
+		ONENAND_SET_NEXT_BUFFERRAM(this);
+		buf += thislen;
+		column = 0;
+		cond_resched();
+		/* Now wait for load */
+		onenand_update_bufferram(mtd, from, 0);
+		ret = this->wait(mtd, FL_READING);
+	}
+
+	if (ret && ret != -EBADMSG)
+		printk(KERN_ERR "%s: read failed = 0x%x\n", __func__, ret);
+
+	*retlen = read;
+	return ret;
+}
+
 /**
  * onenand_read_oob_nolock - [MTD Interface] OneNAND read out-of-band
  * @param mtd		MTD device structure
@@ -1363,6 +1437,17 @@ static int onenand_read_oob_nolock(struct mtd_info *mtd, loff_t from,
 
 	stats = mtd->ecc_stats;
 
+	/*
+	 * Two DataRAMs are available, so use read-while-load unless the
+	 * controller emulates the BufferRAM (ONENAND_NO_OOB_RWL)
+	 */
+	if (!ONENAND_IS_4KB_PAGE(this) &&
+	    !(this->options & ONENAND_NO_OOB_RWL)) {
+		ret = onenand_rwl_read_oob(mtd, from, buf, len, column,
+					   oobsize, mode, &read);
+		goto out;
+	}
+
 	readcmd = ONENAND_IS_4KB_PAGE(this) ? ONENAND_CMD_READ : ONENAND_CMD_READOOB;
 
 	while (read < len) {
@@ -1405,6 +1490,7 @@ static int onenand_read_oob_nolock(struct mtd_info *mtd, loff_t from,
 		}
 	}
 
+out:
 	ops->oobretlen = read;
 
 	if (ret)
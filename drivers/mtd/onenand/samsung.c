@@ -11,7 +11,7 @@
  *
  * Implementation:
  *	S3C64XX and S5PC100: emulate the pseudo BufferRAM
- *	S5PC110: use DMA
+ *	S5PC110: use DMA, chained per physical page and driven by interrupt
  */
 
 #include <linux/module.h>
@@ -150,6 +150,21 @@ enum soc_type {
 #define S5PC110_DMA_DIR_READ		0x0
 #define S5PC110_DMA_DIR_WRITE		0x1
 
+/*
+ * The DMA engine moves one contiguous area per command. A page going to a
+ * vmalloc buffer is split by physical page, so the whole page transfer is
+ * queued as a chain and the next descriptor is kicked from the interrupt.
+ */
+#define S5PC110_DMA_MAX_DESC		(SZ_4K / PAGE_SIZE + 1)
+/* Smaller transfers are cheaper with the CPU copy */
+#define S5PC110_DMA_MIN_SIZE		512
+
+struct s5pc110_dma_desc {
+	dma_addr_t	mem;
+	dma_addr_t	ram;
+	size_t		len;
+};
+
 struct s3c_onenand {
 	struct mtd_info	*mtd;
 	struct platform_device	*pdev;
@@ -167,6 +182,12 @@ struct s3c_onenand {
 	struct resource *dma_res;
 	unsigned long	phys_base;
 	struct completion	complete;
+	struct s5pc110_dma_desc	desc[S5PC110_DMA_MAX_DESC];
+	int		desc_cnt;
+	int		desc_idx;
+	int		desc_page;
+	int		dma_dir;
+	int		dma_err;
 	struct mtd_partition *parts;
 };
 
@@ -610,48 +631,92 @@ static int onenand_write_bufferram(struct mtd_info *mtd, int area,
 	return 0;
 }
 
-static int (*s5pc110_dma_ops)(void *dst, void *src, size_t count, int direction);
+static int (*s5pc110_dma_ops)(int direction);
 
-static int s5pc110_dma_poll(void *dst, void *src, size_t count, int direction)
+static void s5pc110_dma_start(struct s5pc110_dma_desc *desc, int direction)
 {
 	void __iomem *base = onenand->dma_addr;
-	int status;
-	unsigned long timeout;
-
-	writel(src, base + S5PC110_DMA_SRC_ADDR);
-	writel(dst, base + S5PC110_DMA_DST_ADDR);
 
 	if (direction == S5PC110_DMA_DIR_READ) {
+		writel(desc->ram, base + S5PC110_DMA_SRC_ADDR);
+		writel(desc->mem, base + S5PC110_DMA_DST_ADDR);
 		writel(S5PC110_DMA_SRC_CFG_READ, base + S5PC110_DMA_SRC_CFG);
 		writel(S5PC110_DMA_DST_CFG_READ, base + S5PC110_DMA_DST_CFG);
 	} else {
+		writel(desc->mem, base + S5PC110_DMA_SRC_ADDR);
+		writel(desc->ram, base + S5PC110_DMA_DST_ADDR);
 		writel(S5PC110_DMA_SRC_CFG_WRITE, base + S5PC110_DMA_SRC_CFG);
 		writel(S5PC110_DMA_DST_CFG_WRITE, base + S5PC110_DMA_DST_CFG);
 	}
 
-	writel(count, base + S5PC110_DMA_TRANS_SIZE);
+	writel(desc->len, base + S5PC110_DMA_TRANS_SIZE);
 	writel(direction, base + S5PC110_DMA_TRANS_DIR);
 
 	writel(S5PC110_DMA_TRANS_CMD_TR, base + S5PC110_DMA_TRANS_CMD);
+}
 
-	/*
-	 * There's no exact timeout values at Spec.
-	 * In real case it takes under 1 msec.
-	 * So 20 msecs are enough.
-	 */
-	timeout = jiffies + msecs_to_jiffies(20);
+/*
+ * The engine has no abort command. After a timeout, keep the interrupt
+ * from kicking the rest of the chain and wait for the descriptor that is
+ * on the bus to drain, so the caller can unmap the buffer and fall back
+ * to the CPU copy without the DMA still writing into it.
+ */
+static void s5pc110_dma_stop(void)
+{
+	void __iomem *base = onenand->dma_addr;
+	unsigned long flags, timeout;
+	int status;
+
+	local_irq_save(flags);
+	onenand->dma_err = -ETIMEDOUT;
+	local_irq_restore(flags);
 
+	timeout = jiffies + msecs_to_jiffies(20);
 	do {
 		status = readl(base + S5PC110_DMA_TRANS_STATUS);
-		if (status & S5PC110_DMA_TRANS_STATUS_TE) {
-			writel(S5PC110_DMA_TRANS_CMD_TEC,
-					base + S5PC110_DMA_TRANS_CMD);
-			return -EIO;
-		}
-	} while (!(status & S5PC110_DMA_TRANS_STATUS_TD) &&
+	} while ((status & S5PC110_DMA_TRANS_STATUS_TB) &&
 		time_before(jiffies, timeout));
 
-	writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
+	if (status & S5PC110_DMA_TRANS_STATUS_TB)
+		dev_err(&onenand->pdev->dev, "DMA transfer didn't stop\n");
+
+	writel(S5PC110_DMA_TRANS_CMD_TDC | S5PC110_DMA_TRANS_CMD_TEC,
+			base + S5PC110_DMA_TRANS_CMD);
+}
+
+static int s5pc110_dma_poll(int direction)
+{
+	void __iomem *base = onenand->dma_addr;
+	int i, status;
+	unsigned long timeout;
+
+	for (i = 0; i < onenand->desc_cnt; i++) {
+		s5pc110_dma_start(&onenand->desc[i], direction);
+
+		/*
+		 * There's no exact timeout values at Spec.
+		 * In real case it takes under 1 msec.
+		 * So 20 msecs are enough.
+		 */
+		timeout = jiffies + msecs_to_jiffies(20);
+
+		do {
+			status = readl(base + S5PC110_DMA_TRANS_STATUS);
+			if (status & S5PC110_DMA_TRANS_STATUS_TE) {
+				writel(S5PC110_DMA_TRANS_CMD_TEC,
+						base + S5PC110_DMA_TRANS_CMD);
+				return -EIO;
+			}
+		} while (!(status & S5PC110_DMA_TRANS_STATUS_TD) &&
+			time_before(jiffies, timeout));
+
+		if (!(status & S5PC110_DMA_TRANS_STATUS_TD)) {
+			s5pc110_dma_stop();
+			return -ETIMEDOUT;
+		}
+
+		writel(S5PC110_DMA_TRANS_CMD_TDC, base + S5PC110_DMA_TRANS_CMD);
+	}
 
 	return 0;
 }
@@ -666,19 +731,28 @@ static irqreturn_t s5pc110_onenand_irq(int irq, void *data)
 	if (likely(status & S5PC110_INTC_DMA_TD))
 		cmd = S5PC110_DMA_TRANS_CMD_TDC;
 
-	if (unlikely(status & S5PC110_INTC_DMA_TE))
+	if (unlikely(status & S5PC110_INTC_DMA_TE)) {
 		cmd = S5PC110_DMA_TRANS_CMD_TEC;
+		onenand->dma_err = -EIO;
+	}
 
 	writel(cmd, base + S5PC110_DMA_TRANS_CMD);
 	writel(status, base + S5PC110_INTC_DMA_CLR);
 
+	/* Kick the next descriptor of the chain from here */
+	if (!onenand->dma_err && ++onenand->desc_idx < onenand->desc_cnt) {
+		s5pc110_dma_start(&onenand->desc[onenand->desc_idx],
+				  onenand->dma_dir);
+		return IRQ_HANDLED;
+	}
+
 	if (!onenand->complete.done)
 		complete(&onenand->complete);
 
 	return IRQ_HANDLED;
 }
 
-static int s5pc110_dma_irq(void *dst, void *src, size_t count, int direction)
+static int s5pc110_dma_irq(int direction)
 {
 	void __iomem *base = onenand->dma_addr;
 	int status;
@@ -689,38 +763,107 @@ static int s5pc110_dma_irq(void *dst, void *src, size_t count, int direction)
 		writel(status, base + S5PC110_INTC_DMA_MASK);
 	}
 
-	writel(src, base + S5PC110_DMA_SRC_ADDR);
-	writel(dst, base + S5PC110_DMA_DST_ADDR);
+	INIT_COMPLETION(onenand->complete);
+	onenand->desc_idx = 0;
+	onenand->dma_dir = direction;
+	onenand->dma_err = 0;
 
-	if (direction == S5PC110_DMA_DIR_READ) {
-		writel(S5PC110_DMA_SRC_CFG_READ, base + S5PC110_DMA_SRC_CFG);
-		writel(S5PC110_DMA_DST_CFG_READ, base + S5PC110_DMA_DST_CFG);
-	} else {
-		writel(S5PC110_DMA_SRC_CFG_WRITE, base + S5PC110_DMA_SRC_CFG);
-		writel(S5PC110_DMA_DST_CFG_WRITE, base + S5PC110_DMA_DST_CFG);
+	s5pc110_dma_start(&onenand->desc[0], direction);
+
+	/* The whole chain is done in the same 20 msecs as one transfer */
+	if (!wait_for_completion_timeout(&onenand->complete,
+					 msecs_to_jiffies(20))) {
+		s5pc110_dma_stop();
+		return -ETIMEDOUT;
 	}
 
-	writel(count, base + S5PC110_DMA_TRANS_SIZE);
-	writel(direction, base + S5PC110_DMA_TRANS_DIR);
+	return onenand->dma_err;
+}
 
-	writel(S5PC110_DMA_TRANS_CMD_TR, base + S5PC110_DMA_TRANS_CMD);
+static void s5pc110_dma_unmap_chain(struct device *dev,
+		enum dma_data_direction dir)
+{
+	struct s5pc110_dma_desc *desc = onenand->desc;
+	int i;
+
+	for (i = 0; i < onenand->desc_cnt; i++, desc++) {
+		if (onenand->desc_page)
+			dma_unmap_page(dev, desc->mem, desc->len, dir);
+		else
+			dma_unmap_single(dev, desc->mem, desc->len, dir);
+	}
+
+	onenand->desc_cnt = 0;
+}
+
+/*
+ * Build the descriptor chain for a DMA between the BufferRAM and the buffer.
+ * Lowmem buffers are physically contiguous and need one descriptor,
+ * vmalloc buffers get one descriptor per physical page they cover.
+ */
+static int s5pc110_dma_map_chain(struct device *dev, void *buf, size_t count,
+		dma_addr_t ram, enum dma_data_direction dir)
+{
+	struct s5pc110_dma_desc *desc = onenand->desc;
+	struct page *page;
+	size_t ofs, len;
+
+	onenand->desc_cnt = 0;
+
+	if (buf < high_memory) {
+		onenand->desc_page = 0;
+		desc->mem = dma_map_single(dev, buf, count, dir);
+		if (dma_mapping_error(dev, desc->mem))
+			return -ENOMEM;
+		desc->ram = ram;
+		desc->len = count;
+		onenand->desc_cnt = 1;
+		return 0;
+	}
+
+	onenand->desc_page = 1;
+	while (count) {
+		if (onenand->desc_cnt == S5PC110_DMA_MAX_DESC)
+			goto unmap;
 
-	wait_for_completion_timeout(&onenand->complete, msecs_to_jiffies(20));
+		page = vmalloc_to_page(buf);
+		if (!page)
+			goto unmap;
+
+		ofs = (size_t) buf & ~PAGE_MASK;
+		len = min_t(size_t, count, PAGE_SIZE - ofs);
+
+		desc->mem = dma_map_page(dev, page, ofs, len, dir);
+		if (dma_mapping_error(dev, desc->mem))
+			goto unmap;
+		desc->ram = ram;
+		desc->len = len;
+		onenand->desc_cnt++;
+
+		buf += len;
+		ram += len;
+		count -= len;
+		desc++;
+	}
 
 	return 0;
+
+unmap:
+	s5pc110_dma_unmap_chain(dev, dir);
+	return -ENOMEM;
 }
 
-static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
-		unsigned char *buffer, int offset, size_t count)
+static inline int s5pc110_dma_possible(void *buf, int offset, size_t count)
+{
+	return onenand->dma_addr && !(offset & 3) && !((size_t) buf & 3) &&
+		!(count & 3) && count >= S5PC110_DMA_MIN_SIZE;
+}
+
+static void __iomem *s5pc110_bufferram(struct mtd_info *mtd, int area)
 {
 	struct onenand_chip *this = mtd->priv;
-	void __iomem *p;
-	void *buf = (void *) buffer;
-	dma_addr_t dma_src, dma_dst;
-	int err, ofs, page_dma = 0;
-	struct device *dev = &onenand->pdev->dev;
+	void __iomem *p = this->base + area;
 
-	p = this->base + area;
 	if (ONENAND_CURRENT_BUFFERRAM(this)) {
 		if (area == ONENAND_DATARAM)
 			p += this->writesize;
@@ -728,44 +871,34 @@ static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
 			p += mtd->oobsize;
 	}
 
-	if (offset & 3 || (size_t) buf & 3 ||
-		!onenand->dma_addr || count != mtd->writesize)
-		goto normal;
+	return p;
+}
 
-	/* Handle vmalloc address */
-	if (buf >= high_memory) {
-		struct page *page;
+static int s5pc110_read_bufferram(struct mtd_info *mtd, int area,
+		unsigned char *buffer, int offset, size_t count)
+{
+	struct onenand_chip *this = mtd->priv;
+	void __iomem *p;
+	void *buf = (void *) buffer;
+	dma_addr_t dma_src;
+	int err;
+	struct device *dev = &onenand->pdev->dev;
 
-		if (((size_t) buf & PAGE_MASK) !=
-		    ((size_t) (buf + count - 1) & PAGE_MASK))
-			goto normal;
-		page = vmalloc_to_page(buf);
-		if (!page)
-			goto normal;
+	p = s5pc110_bufferram(mtd, area);
 
-		/* Page offset */
-		ofs = ((size_t) buf & ~PAGE_MASK);
-		page_dma = 1;
+	if (!s5pc110_dma_possible(buf, offset, count))
+		goto normal;
 
-		/* DMA routine */
-		dma_src = onenand->phys_base + (p - this->base);
-		dma_dst = dma_map_page(dev, page, ofs, count, DMA_FROM_DEVICE);
-	} else {
-		/* DMA routine */
-		dma_src = onenand->phys_base + (p - this->base);
-		dma_dst = dma_map_single(dev, buf, count, DMA_FROM_DEVICE);
-	}
-	if (dma_mapping_error(dev, dma_dst)) {
+	/* DMA routine */
+	dma_src = onenand->phys_base + (p - this->base) + offset;
+	if (s5pc110_dma_map_chain(dev, buf, count, dma_src, DMA_FROM_DEVICE)) {
 		dev_err(dev, "Couldn't map a %d byte buffer for DMA\n", count);
 		goto normal;
 	}
-	err = s5pc110_dma_ops((void *) dma_dst, (void *) dma_src,
-			count, S5PC110_DMA_DIR_READ);
 
-	if (page_dma)
-		dma_unmap_page(dev, dma_dst, count, DMA_FROM_DEVICE);
-	else
-		dma_unmap_single(dev, dma_dst, count, DMA_FROM_DEVICE);
+	err = s5pc110_dma_ops(S5PC110_DMA_DIR_READ);
+
+	s5pc110_dma_unmap_chain(dev, DMA_FROM_DEVICE);
 
 	if (!err)
 		return 0;
@@ -782,6 +915,53 @@ normal:
 	return 0;
 }
 
+static int s5pc110_write_bufferram(struct mtd_info *mtd, int area,
+		const unsigned char *buffer, int offset, size_t count)
+{
+	struct onenand_chip *this = mtd->priv;
+	void __iomem *p;
+	void *buf = (void *) buffer;
+	dma_addr_t dma_dst;
+	int err;
+	struct device *dev = &onenand->pdev->dev;
+
+	p = s5pc110_bufferram(mtd, area);
+
+	if (!s5pc110_dma_possible(buf, offset, count))
+		goto normal;
+
+	/* DMA routine */
+	dma_dst = onenand->phys_base + (p - this->base) + offset;
+	if (s5pc110_dma_map_chain(dev, buf, count, dma_dst, DMA_TO_DEVICE)) {
+		dev_err(dev, "Couldn't map a %d byte buffer for DMA\n", count);
+		goto normal;
+	}
+
+	err = s5pc110_dma_ops(S5PC110_DMA_DIR_WRITE);
+
+	s5pc110_dma_unmap_chain(dev, DMA_TO_DEVICE);
+
+	if (!err)
+		return 0;
+
+normal:
+	if (ONENAND_CHECK_BYTE_ACCESS(count)) {
+		unsigned short word;
+
+		/* Align with word(16-bit) size */
+		count--;
+
+		/* Read word and save byte */
+		word = this->read_word(p + offset + count);
+		word = (word & ~0xff) | buffer[count];
+		this->write_word(word, p + offset + count);
+	}
+
+	memcpy(p + offset, buffer, count);
+
+	return 0;
+}
+
 static int s5pc110_chip_probe(struct mtd_info *mtd)
 {
 	/* Now just return 0 */
@@ -914,6 +1094,7 @@ static void s3c_onenand_setup(struct mtd_info *mtd)
 	} else if (onenand->type == TYPE_S5PC110) {
 		/* Use generic onenand functions */
 		this->read_bufferram = s5pc110_read_bufferram;
+		this->write_bufferram = s5pc110_write_bufferram;
 		this->chip_probe = s5pc110_chip_probe;
 		return;
 	} else {
@@ -1004,6 +1185,9 @@ static int s3c_onenand_probe(struct platform_device *pdev)
 	this->options |= ONENAND_SKIP_UNLOCK_CHECK;
 
 	if (onenand->type != TYPE_S5PC110) {
+		/* The AHB access loads and transfers a page in one go */
+		this->options |= ONENAND_NO_OOB_RWL;
+
 		r = platform_get_resource(pdev, IORESOURCE_MEM, 1);
 		if (!r) {
 			dev_err(&pdev->dev, "no buffer memory resource defined\n");
@@ -16,6 +16,18 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * The minfree levels are checked from a shrinker as before. In addition
+ * kswapd and direct reclaim report how many pages they scanned and reclaimed,
+ * and once the share that could not be reclaimed over a window of scanned
+ * pages reaches the pressure_medium percentage the killer runs right away
+ * instead of waiting for the next shrinker pass. At pressure_critical it
+ * kills a process of the highest adj level even above all minfree levels,
+ * before the device starts to thrash.
+ *
+ * Processes are kept in one list per oom_adj value, updated at fork, exit and
+ * when oom_adj or oom_score_adj is written, so a victim is found by looking at
+ * the highest non-empty list instead of walking every task.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +47,8 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -52,6 +66,23 @@ static size_t lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+/* Percentage of scanned pages reclaim failed to free */
+static int lowmem_pressure_medium = 60;
+static int lowmem_pressure_critical = 95;
+
+/* Pressure is computed over windows of this many scanned pages */
+#define LOWMEM_PRESSURE_WIN	(SWAP_CLUSTER_MAX * 16)
+
+static unsigned long lowmem_scanned;
+static unsigned long lowmem_reclaimed;
+static int lowmem_pressure;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+
+/* One list of thread group leaders per oom_adj value, under tasklist_lock */
+#define LOWMEM_BUCKETS		(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct hlist_head lowmem_buckets[LOWMEM_BUCKETS];
+
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
@@ -79,32 +110,54 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static struct hlist_head *lowmem_bucket(struct task_struct *p)
+{
+	return &lowmem_buckets[p->signal->oom_adj - OOM_DISABLE];
+}
+
+/* Called with tasklist_lock write-locked */
+void lowmem_adj_add(struct task_struct *p)
+{
+	hlist_add_head(&p->lowmem_node, lowmem_bucket(p));
+}
+
+/* Called with tasklist_lock write-locked */
+void lowmem_adj_del(struct task_struct *p)
+{
+	hlist_del_init(&p->lowmem_node);
+}
+
+/* Called with tasklist_lock write-locked when @new takes over as leader */
+void lowmem_adj_replace(struct task_struct *old, struct task_struct *new)
+{
+	hlist_del_init(&old->lowmem_node);
+	hlist_add_head(&new->lowmem_node, lowmem_bucket(new));
+}
+
+/* Move the process of @p to the bucket of its current oom_adj */
+void lowmem_adj_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	write_lock_irq(&tasklist_lock);
+	leader = p->group_leader;
+	if (pid_alive(p) && !hlist_unhashed(&leader->lowmem_node)) {
+		hlist_del(&leader->lowmem_node);
+		hlist_add_head(&leader->lowmem_node, lowmem_bucket(leader));
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
+/* Lowest adj that may be killed, OOM_ADJUST_MAX + 1 if none */
+static int lowmem_min_adj(int use_pressure)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
-	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
-	 * this pass.
-	 *
-	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-		return 0;
-
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
@@ -116,55 +169,59 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
-	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
-			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
-	rem = global_page_state(NR_ACTIVE_ANON) +
-		global_page_state(NR_ACTIVE_FILE) +
-		global_page_state(NR_INACTIVE_ANON) +
-		global_page_state(NR_INACTIVE_FILE);
-	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
-			     sc->nr_to_scan, sc->gfp_mask, rem);
-		return rem;
-	}
-	selected_oom_adj = min_adj;
+
+	/*
+	 * Reclaim is barely making progress, free something before the
+	 * device thrashes even though no minfree level has been crossed.
+	 */
+	if (use_pressure && min_adj == OOM_ADJUST_MAX + 1 && array_size &&
+	    lowmem_pressure >= lowmem_pressure_critical)
+		min_adj = lowmem_adj[array_size - 1];
+
+	lowmem_print(3, "lowmem_kill pressure %d, ofree %d %d, ma %d\n",
+		     lowmem_pressure, other_free, other_file, min_adj);
+
+	return min_adj;
+}
+
+/*
+ * Kill the largest process of the highest adj at or above @min_adj.
+ * Empty buckets cost one check each, but the first non-empty bucket is
+ * walked in full to find its largest task, and buckets whose tasks have
+ * all exited their mm are walked too before moving down. So the cost is
+ * linear in the number of processes at the adj levels examined, not in
+ * all processes.
+ */
+static int lowmem_kill_adj(int min_adj)
+{
+	struct task_struct *p;
+	struct task_struct *selected = NULL;
+	struct hlist_node *node;
+	int tasksize;
+	int bucket;
+	int selected_tasksize = 0;
+	int selected_oom_adj = 0;
 
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+	for (bucket = LOWMEM_BUCKETS - 1;
+	     bucket >= min_adj - OOM_DISABLE && !selected; bucket--) {
+		hlist_for_each_entry(p, node, &lowmem_buckets[bucket],
+				     lowmem_node) {
+			task_lock(p);
+			if (!p->mm) {
+				task_unlock(p);
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			}
+			tasksize = get_mm_rss(p->mm);
+			task_unlock(p);
+			if (tasksize <= 0 || tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = bucket + OOM_DISABLE;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, selected_oom_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
@@ -173,11 +230,69 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
 	}
+	read_unlock(&tasklist_lock);
+
+	return selected_tasksize;
+}
+
+static int lowmem_death_pending(void)
+{
+	return lowmem_deathpending &&
+	       time_before_eq(jiffies, lowmem_deathpending_timeout);
+}
+
+static void lowmem_kill(struct work_struct *work)
+{
+	int min_adj;
+
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; its memory is on the way.
+	 */
+	if (lowmem_death_pending())
+		return;
+
+	min_adj = lowmem_min_adj(1);
+	if (min_adj != OOM_ADJUST_MAX + 1)
+		lowmem_kill_adj(min_adj);
+}
+
+/*
+ * The minfree levels hold whatever the reclaim efficiency is, so they are
+ * still enforced from reclaim through the shrinker.
+ */
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int rem;
+	int min_adj;
+
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; indicating to vmscan
+	 * that we have nothing further to offer on
+	 * this pass.
+	 */
+	if (lowmem_death_pending())
+		return 0;
+
+	rem = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (sc->nr_to_scan <= 0)
+		return rem;
+
+	min_adj = lowmem_min_adj(0);
+	if (min_adj == OOM_ADJUST_MAX + 1) {
+		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
+			     sc->nr_to_scan, sc->gfp_mask, rem);
+		return rem;
+	}
+
+	rem -= lowmem_kill_adj(min_adj);
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -186,8 +301,50 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static DECLARE_WORK(lowmem_kill_work, lowmem_kill);
+static struct workqueue_struct *lowmem_wq;
+
+/*
+ * Called by reclaim after each pass over a zone. Cheap unless a window
+ * fills up, then the killer is queued if reclaim is struggling.
+ */
+void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+		       unsigned long reclaimed)
+{
+	int pressure;
+
+	if (!scanned || !lowmem_wq)
+		return;
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_scanned += scanned;
+	lowmem_reclaimed += reclaimed;
+	if (lowmem_scanned < LOWMEM_PRESSURE_WIN) {
+		spin_unlock(&lowmem_pressure_lock);
+		return;
+	}
+	scanned = lowmem_scanned;
+	reclaimed = min(lowmem_reclaimed, scanned);
+	lowmem_scanned = 0;
+	lowmem_reclaimed = 0;
+	spin_unlock(&lowmem_pressure_lock);
+
+	pressure = 100 - reclaimed * 100 / scanned;
+	lowmem_print(5, "lowmem_vmpressure %lu/%lu, pressure %d\n",
+		     reclaimed, scanned, pressure);
+
+	lowmem_pressure = pressure;
+	if (pressure >= lowmem_pressure_medium)
+		queue_work(lowmem_wq, &lowmem_kill_work);
+}
+
 static int __init lowmem_init(void)
 {
+	lowmem_wq = alloc_workqueue("lowmemorykiller",
+				    WQ_HIGHPRI | WQ_MEM_RECLAIM, 1);
+	if (!lowmem_wq)
+		return -ENOMEM;
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
@@ -196,10 +353,15 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	destroy_workqueue(lowmem_wq);
 	task_free_unregister(&task_nb);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, int,
+		   S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
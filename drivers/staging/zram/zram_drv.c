@@ -26,10 +26,12 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -42,6 +44,13 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
+/* Compression backends which can be selected through sysfs */
+const char *zram_backends[] = {
+	"lzo",
+	"deflate",
+	NULL
+};
+
 static void zram_stat_inc(u32 *v)
 {
 	*v = *v + 1;
@@ -89,18 +98,19 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
@@ -133,56 +143,264 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+/*
+ * Find a stored object with the same content as the page which hashed
+ * to @checksum and compressed to @data, and take a reference to it.
+ * @scratch must hold @len bytes.
+ */
+static struct zram_entry *zram_dedup_get(struct zram *zram, u32 checksum,
+			const void *data, unsigned int len, void *scratch)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry;
+	struct hlist_node *pos;
+	struct hlist_head *head;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	head = &zram->hash[checksum & (zram->hash_size - 1)];
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, head, node) {
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		zs_obj_read(zram->mem_pool, entry->handle, scratch, len);
+		if (!memcmp(scratch, data, len)) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
 		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static struct zram_entry *zram_dedup_add(struct zram *zram, u32 checksum,
+			unsigned long handle, unsigned int len)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->refcount = 1;
+	entry->checksum = checksum;
+	entry->len = len;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node,
+		&zram->hash[checksum & (zram->hash_size - 1)]);
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference to @entry, the object goes with the last one.
+ * Returns the number of references left.
+ */
+static unsigned int zram_dedup_put(struct zram *zram,
+			struct zram_entry *entry)
+{
+	unsigned int refcount;
+
+	spin_lock(&zram->dedup_lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	if (!refcount) {
+		zs_free(zram->mem_pool, entry->handle);
+		kfree(entry);
+	}
+
+	return refcount;
+}
+
+/* Pool handle of the object backing a page */
+static unsigned long zram_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = ((struct zram_entry *)handle)->handle;
+
+	return handle;
+}
+
+/* Block 0 is never used, a zero handle means an empty slot */
+static unsigned long zram_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	do {
+		blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+		if (blk >= zram->nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bitmap));
+
+	return blk;
+}
+
+static void zram_free_block(struct zram *zram, unsigned long blk)
+{
+	clear_bit(blk, zram->bitmap);
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bdev_rw(struct zram *zram, int rw, struct page *page,
+			unsigned long blk)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *zw;
+
+	zw = container_of(work, struct zram_bdev_work, work);
+	zw->ret = zram_bdev_rw(zw->zram, READ, zw->page, zw->blk);
+}
+
+/*
+ * A bio submitted from our make_request function is only issued once
+ * it returns, so waiting for it there would never end. Let a worker
+ * do the read instead.
+ */
+static int zram_read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bdev_work zw;
+
+	zw.zram = zram;
+	zw.page = page;
+	zw.blk = blk;
+
+	INIT_WORK_ONSTACK(&zw.work, zram_bdev_read_work);
+	schedule_work(&zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	return zw.ret;
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	unsigned long handle = zram->table[index].handle;
+	u16 size = zram->table[index].size;
+	u64 total, wasted;
+
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_block(zram, handle);
+		zram_stat_dec(&zram->stats.bd_count);
+		zram->table[index].handle = 0;
+		return;
+	}
+
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(&zram->stats.pages_same);
+		zram->table[index].handle = 0;
 		return;
 	}
 
+	if (unlikely(!handle))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
+	} else if (size <= PAGE_SIZE / 2) {
+		zram_stat_dec(&zram->stats.good_compress);
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		if (zram_dedup_put(zram, (struct zram_entry *)handle)) {
+			/* Other pages still share the object */
+			zram_stat_dec(&zram->stats.pages_dup);
+			zram_stat64_sub(zram, &zram->stats.dup_data_size,
+					size);
+		} else {
+			zram_stat64_sub(zram, &zram->stats.compr_size, size);
+		}
+	} else {
+		zs_free(zram->mem_pool, handle);
+		zram_stat64_sub(zram, &zram->stats.compr_size, size);
+	}
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+
+	/* Freed objects leave holes in the pool, close them up later */
+	total = zs_get_total_size_bytes(zram->mem_pool);
+	wasted = zs_get_wasted_bytes(zram->mem_pool);
+	if (wasted > PAGE_SIZE && wasted > total / 100 * compact_waste_perc &&
+	    wasted >= (u64)zram->compact_wasted + PAGE_SIZE &&
+	    time_after_eq(jiffies, zram->compact_next))
+		schedule_work(&zram->compact_work);
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
+	unsigned int pos;
+	unsigned long *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -191,83 +409,230 @@ static void handle_zero_page(struct page *page)
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
-	unsigned char *user_mem, *cmem;
+	unsigned char *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
-
-	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_obj_read(zram->mem_pool, zram_handle(zram, index),
+			user_mem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *stream;
+
+	spin_lock(&zram->stream_lock);
+	while (list_empty(&zram->stream_list)) {
+		spin_unlock(&zram->stream_lock);
+		wait_event(zram->stream_wait,
+			!list_empty(&zram->stream_list));
+		spin_lock(&zram->stream_lock);
+	}
+
+	stream = list_first_entry(&zram->stream_list,
+				struct zram_stream, list);
+	list_del(&stream->list);
+	spin_unlock(&zram->stream_lock);
+
+	return stream;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *stream)
+{
+	spin_lock(&zram->stream_lock);
+	list_add(&stream->list, &zram->stream_list);
+	spin_unlock(&zram->stream_lock);
+
+	wake_up(&zram->stream_wait);
+}
+
+static void zram_destroy_streams(struct zram *zram)
 {
+	struct zram_stream *stream, *tmp;
+
+	list_for_each_entry_safe(stream, tmp, &zram->stream_list, list) {
+		list_del(&stream->list);
+		if (!IS_ERR_OR_NULL(stream->tfm))
+			crypto_free_comp(stream->tfm);
+		free_pages((unsigned long)stream->buffer, 1);
+		kfree(stream);
+	}
+}
 
+static int zram_create_streams(struct zram *zram)
+{
 	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	struct zram_stream *stream;
+
+	for (i = 0; i < num_online_cpus(); i++) {
+		stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+		if (!stream)
+			goto fail;
+
+		stream->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+		/* An incompressible page may expand, so use two pages */
+		stream->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		list_add(&stream->list, &zram->stream_list);
+		if (IS_ERR(stream->tfm) || !stream->buffer)
+			goto fail;
+	}
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	return 0;
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+fail:
+	zram_destroy_streams(zram);
+	return -ENOMEM;
+}
 
-		page = bvec->bv_page;
+/*
+ * Release the slots queued by zram_slot_free_notify().
+ * Called with zram->lock held.
+ */
+static void zram_free_pending_slots(struct zram *zram)
+{
+	struct zram_slot_free *free_rq;
+	unsigned long index;
+	int overflow;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	spin_lock(&zram->slot_free_lock);
+	while (zram->slot_free_rq) {
+		free_rq = zram->slot_free_rq;
+		zram->slot_free_rq = free_rq->next;
+		spin_unlock(&zram->slot_free_lock);
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+		zram_free_page(zram, free_rq->index);
+		kfree(free_rq);
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+		spin_lock(&zram->slot_free_lock);
+	}
+	overflow = zram->slot_free_overflow;
+	zram->slot_free_overflow = 0;
+	spin_unlock(&zram->slot_free_lock);
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+	if (!overflow)
+		return;
+
+	for_each_set_bit(index, zram->slot_free_map,
+			 zram->disksize >> PAGE_SHIFT) {
+		if (test_and_clear_bit(index, zram->slot_free_map))
+			zram_free_page(zram, index);
+	}
+}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+static void zram_slot_free_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, free_work);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	mutex_lock(&zram->lock);
+	zram_free_pending_slots(zram);
+	mutex_unlock(&zram->lock);
+}
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+void zram_compact(struct zram *zram)
+{
+	unsigned long freed;
+
+	freed = zs_compact(zram->mem_pool);
+	zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
+
+	zram->compact_wasted = zs_get_wasted_bytes(zram->mem_pool);
+	zram->compact_next = jiffies + msecs_to_jiffies(compact_interval_ms);
+}
+
+static void zram_compact_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, compact_work);
+
+	zram_compact(zram);
+}
+
+/*
+ * Fill @page with the content of slot @index. The lock is held while the
+ * object is looked up and copied, which keeps writeback from freeing it
+ * underneath us. Decompression runs unlocked.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned int clen, size;
+	unsigned long handle;
+	struct zram_stream *stream;
+	unsigned char *user_mem;
+
+	mutex_lock(&zram->lock);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		mutex_unlock(&zram->lock);
+		handle_same_page(page, handle);
+		return 0;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		mutex_unlock(&zram->lock);
+		return zram_read_from_bdev(zram, page, handle);
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+	/* Requested page is not present in compressed area */
+	if (unlikely(!handle)) {
+		mutex_unlock(&zram->lock);
+		pr_debug("Read before write: page=%u\n", index);
+		handle_same_page(page, 0);
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		mutex_unlock(&zram->lock);
+		return 0;
+	}
+
+	size = zram->table[index].size;
+	stream = zram_stream_get(zram);
+	zs_obj_read(zram->mem_pool, zram_handle(zram, index),
+			stream->buffer, size);
+	mutex_unlock(&zram->lock);
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
+
+	ret = crypto_comp_decompress(stream->tfm, stream->buffer, size,
+				user_mem, &clen);
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	zram_stream_put(zram, stream);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return -EIO;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+static void zram_read(struct zram *zram, struct bio *bio)
+{
+
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_reads);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (zram_read_page(zram, bvec->bv_page, index)) {
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
-
-		flush_dcache_page(page);
 		index++;
 	}
 
@@ -289,43 +654,53 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+		int ret, incompressible = 0, dedup = 0;
+		unsigned int clen;
+		unsigned long handle, element;
+		u32 checksum = 0;
+		struct page *page;
+		struct zram_stream *stream;
+		struct zram_entry *entry = NULL;
+		unsigned char *user_mem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+		if (page_same_filled(user_mem, &element)) {
 			kunmap_atomic(user_mem, KM_USER0);
+			mutex_lock(&zram->lock);
+			zram_free_pending_slots(zram);
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			if (zram->table[index].handle ||
+					zram_test_flag(zram, index, ZRAM_SAME))
+				zram_free_page(zram, index);
+			zram_stat_inc(&zram->stats.pages_same);
+			zram_set_flag(zram, index, ZRAM_SAME);
+			zram->table[index].handle = element;
 			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
 			index++;
 			continue;
 		}
+		kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		/* Compression runs outside of the lock, on its own stream */
+		stream = zram_stream_get(zram);
+		src = stream->buffer;
 
+		user_mem = kmap_atomic(page, KM_USER0);
+		clen = PAGE_SIZE * 2;
+		ret = crypto_comp_compress(stream->tfm, user_mem, PAGE_SIZE,
+					src, &clen);
+		if (zram->use_dedup)
+			checksum = jhash2((u32 *)user_mem,
+					PAGE_SIZE / sizeof(u32), 0);
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_stream_put(zram, stream);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -337,58 +712,93 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		 * errors which has side effect of hanging the system.
 		 */
 		if (unlikely(clen > max_zpage_size)) {
+			incompressible = 1;
 			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
+		}
+
+		/*
+		 * Compressed output stays below max_zpage_size, so the
+		 * second half of the stream buffer is free for comparing.
+		 * A stored page is compared raw, the output is unused then.
+		 */
+		if (zram->use_dedup) {
+			if (unlikely(incompressible)) {
+				user_mem = kmap_atomic(page, KM_USER0);
+				entry = zram_dedup_get(zram, checksum,
+						user_mem, clen, src);
+				kunmap_atomic(user_mem, KM_USER0);
+			} else {
+				entry = zram_dedup_get(zram, checksum,
+						src, clen, src + PAGE_SIZE);
 			}
+		}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+		if (entry) {
+			zram_stream_put(zram, stream);
+			handle = (unsigned long)entry;
+			dedup = 1;
+			goto update;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		/* The pool locks itself, so the object is stored unlocked */
+		handle = zs_malloc(zram->mem_pool, clen,
+				GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!handle)) {
+			zram_stream_put(zram, stream);
 			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
+				"page: %u, size=%u\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		if (unlikely(incompressible)) {
+			src = kmap_atomic(page, KM_USER0);
+			zs_obj_write(zram->mem_pool, handle, src, clen);
+			kunmap_atomic(src, KM_USER0);
+		} else {
+			zs_obj_write(zram->mem_pool, handle, src, clen);
+		}
+		zram_stream_put(zram, stream);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		/* Without an entry the page is simply never shared */
+		if (zram->use_dedup) {
+			struct zram_entry *new;
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+			new = zram_dedup_add(zram, checksum, handle, clen);
+			if (new) {
+				handle = (unsigned long)new;
+				dedup = 1;
+			}
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+update:
+		mutex_lock(&zram->lock);
+		zram_free_pending_slots(zram);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		if (zram->table[index].handle ||
+				zram_test_flag(zram, index, ZRAM_SAME))
+			zram_free_page(zram, index);
+
+		zram->table[index].handle = handle;
+		zram->table[index].size = clen;
+		if (dedup)
+			zram_set_flag(zram, index, ZRAM_DEDUP);
 
 		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		if (unlikely(incompressible)) {
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_stat_inc(&zram->stats.pages_expand);
+		}
+		if (entry) {
+			zram_stat_inc(&zram->stats.pages_dup);
+			zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+		} else {
+			zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		}
 		zram_stat_inc(&zram->stats.pages_stored);
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
@@ -405,6 +815,145 @@ out:
 	bio_io_error(bio);
 }
 
+/* Mark every page in memory idle, reads and writes clear it again */
+void zram_mark_idle(struct zram *zram)
+{
+	u32 index;
+
+	mutex_lock(&zram->lock);
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_SAME) &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+	}
+	mutex_unlock(&zram->lock);
+}
+
+/*
+ * Move the pages in memory which have @flag set to the backing device.
+ * Shared pages are left alone. Called with init_lock held.
+ * Returns the number of pages written back or an error.
+ */
+int zram_writeback(struct zram *zram, enum zram_pageflags flag)
+{
+	int ret = 0, count = 0;
+	u32 index;
+	unsigned long blk = 0;
+	struct page *page;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!blk) {
+			blk = zram_alloc_block(zram);
+			if (!blk) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		mutex_lock(&zram->lock);
+		if (!zram->table[index].handle ||
+				!zram_test_flag(zram, index, flag) ||
+				zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB) ||
+				zram_test_flag(zram, index, ZRAM_DEDUP)) {
+			mutex_unlock(&zram->lock);
+			continue;
+		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		mutex_unlock(&zram->lock);
+
+		ret = zram_read_page(zram, page, index);
+		if (!ret)
+			ret = zram_bdev_rw(zram, WRITE, page, blk);
+
+		mutex_lock(&zram->lock);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			/* Failed, or the page changed while it was written */
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			mutex_unlock(&zram->lock);
+			if (ret)
+				break;
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].handle = blk;
+		zram_stat_inc(&zram->stats.bd_count);
+		mutex_unlock(&zram->lock);
+
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		blk = 0;
+		count++;
+		cond_resched();
+	}
+
+	if (blk)
+		zram_free_block(zram, blk);
+	__free_page(page);
+
+	return ret ? ret : count;
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+
+	kfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+}
+
+/* Called with init_lock held, before the device is initialized */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	struct block_device *bdev;
+
+	zram_reset_backing_dev(zram);
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE |
+				FMODE_EXCL, zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	zram->bdev = bdev;
+	zram->nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	zram->bitmap = kzalloc(BITS_TO_LONGS(zram->nr_blocks) *
+				sizeof(long), GFP_KERNEL);
+	zram->backing_dev = kstrdup(path, GFP_KERNEL);
+	if (!zram->bitmap || !zram->backing_dev) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto fail;
+
+	pr_info("Backing device %s, %lu pages\n", path, zram->nr_blocks);
+	return 0;
+
+fail:
+	zram_reset_backing_dev(zram);
+	return ret;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -461,37 +1010,52 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	zram_destroy_streams(zram);
+
+	/* Slots queued for freeing go away with the table */
+	flush_work_sync(&zram->free_work);
+	cancel_work_sync(&zram->compact_work);
+	while (zram->slot_free_rq) {
+		struct zram_slot_free *free_rq = zram->slot_free_rq;
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+		zram->slot_free_rq = free_rq->next;
+		kfree(free_rq);
+	}
+	zram->slot_free_overflow = 0;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		unsigned long handle = zram->table[index].handle;
 
-		if (!page)
+		if (!handle || zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP))
+			zram_dedup_put(zram, (struct zram_entry *)handle);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zs_free(zram->mem_pool, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->slot_free_map);
+	zram->slot_free_map = NULL;
+
+	vfree(zram->hash);
+	zram->hash = NULL;
+
+	zram_reset_backing_dev(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
+	zram->compact_wasted = 0;
+	zram->compact_next = jiffies;
 
 	zram->disksize = 0;
 	mutex_unlock(&zram->init_lock);
@@ -511,17 +1075,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret) {
+		pr_err("Error allocating %s compression streams\n",
+			zram->compressor);
 		goto fail;
 	}
 
@@ -535,12 +1092,30 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->slot_free_map = vzalloc(BITS_TO_LONGS(num_pages) *
+				      sizeof(unsigned long));
+	if (!zram->slot_free_map) {
+		pr_err("Error allocating slot free map\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	if (zram->use_dedup) {
+		zram->hash_size = roundup_pow_of_two(num_pages / 8 ? : 1);
+		zram->hash = vzalloc(zram->hash_size * sizeof(*zram->hash));
+		if (!zram->hash) {
+			pr_err("Error allocating deduplication table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -564,9 +1139,29 @@ fail:
 void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct zram *zram;
+	struct zram_slot_free *free_rq;
 
 	zram = bdev->bd_disk->private_data;
-	zram_free_page(zram, index);
+
+	/*
+	 * We are called under swap_lock and cannot sleep on zram->lock.
+	 * Queue the slot, it is freed before the next write or by the work.
+	 */
+	free_rq = kmalloc(sizeof(*free_rq), GFP_ATOMIC);
+
+	spin_lock(&zram->slot_free_lock);
+	if (free_rq) {
+		free_rq->index = index;
+		free_rq->next = zram->slot_free_rq;
+		zram->slot_free_rq = free_rq;
+	} else {
+		/* Out of atomic memory, mark the slot in the free map */
+		set_bit(index, zram->slot_free_map);
+		zram->slot_free_overflow = 1;
+	}
+	spin_unlock(&zram->slot_free_lock);
+
+	schedule_work(&zram->free_work);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -582,6 +1177,16 @@ static int create_device(struct zram *zram, int device_id)
 	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	INIT_LIST_HEAD(&zram->stream_list);
+	spin_lock_init(&zram->stream_lock);
+	init_waitqueue_head(&zram->stream_wait);
+	spin_lock_init(&zram->slot_free_lock);
+	spin_lock_init(&zram->dedup_lock);
+	INIT_WORK(&zram->free_work, zram_slot_free_work);
+	INIT_WORK(&zram->compact_work, zram_compact_work);
+	zram->compact_next = jiffies;
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -644,6 +1249,9 @@ static void destroy_device(struct zram *zram)
 	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
 			&zram_disk_attr_group);
 
+	/* It may have been set up without the device ever being used */
+	zram_reset_backing_dev(zram);
+
 	if (zram->disk) {
 		del_gendisk(zram->disk);
 		put_disk(zram->disk);
@@ -17,8 +17,11 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/crypto.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,20 +29,11 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
+/* Default compression backend, see zram_backends[] */
+static const char default_compressor[] = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -51,10 +45,22 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
+/*
+ * Compact the pool in the background once this percentage of it
+ * no longer backs any object.
+ */
+static const unsigned compact_waste_perc = 25;
+
+/*
+ * Compaction can leave the pool above that threshold. It is only run
+ * again after this many msecs and once the waste has grown by a page.
+ */
+static const unsigned compact_interval_ms = 1000;
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -68,18 +74,42 @@ enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page is one repeated word, kept in table[page_no].handle */
+	ZRAM_SAME,
+
+	/* table[page_no].handle points to a shared struct zram_entry */
+	ZRAM_DEDUP,
+
+	/* Page lives on the backing device, in block table[page_no].handle */
+	ZRAM_WB,
+
+	/* Page is being written back, cleared if it changes meanwhile */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since it was last marked idle */
+	ZRAM_IDLE,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * Compressed object shared by all pages with the same content. Only
+ * used when deduplication is enabled.
+ */
+struct zram_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	unsigned int refcount;
+	u32 checksum;
+	u16 len;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;
+	u16 size;
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -92,22 +122,68 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
+	u64 pages_compacted;	/* pool pages released by compaction */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written back to it */
+	u64 dup_data_size;	/* compressed bytes shared, not stored again */
+	u32 pages_same;		/* no. of pages filled with one word */
+	u32 pages_dup;		/* no. of pages sharing another's object */
+	u32 bd_count;		/* no. of pages on the backing device */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compression workspace. Each write takes one for the time it compresses
+ * a page, so as many pages as there are streams compress in parallel.
+ */
+struct zram_stream {
+	struct crypto_comp *tfm;
+	void *buffer;
+	struct list_head list;
+};
+
+/* Swap slot freed while a write may hold the table lock */
+struct zram_slot_free {
+	unsigned long index;
+	struct zram_slot_free *next;
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	struct mutex lock;	/* protect table updates */
+	/* Idle compression streams, one per online CPU */
+	struct list_head stream_list;
+	spinlock_t stream_lock;
+	wait_queue_head_t stream_wait;
+	/* Slots freed by swap, released under the lock */
+	struct zram_slot_free *slot_free_rq;
+	/* Slots whose queue entry could not be allocated */
+	unsigned long *slot_free_map;
+	int slot_free_overflow;
+	spinlock_t slot_free_lock;
+	struct work_struct free_work;
+	struct work_struct compact_work;
+	/* Waste left by the last compaction and when it may run again */
+	unsigned long compact_wasted;
+	unsigned long compact_next;
+	/* Content hash of stored pages, NULL unless use_dedup is set */
+	struct hlist_head *hash;
+	unsigned int hash_size;
+	spinlock_t dedup_lock;
+	int use_dedup;
+	/* Optional device incompressible and idle pages are written to */
+	struct block_device *bdev;
+	char *backing_dev;
+	unsigned long *bitmap;	/* blocks of bdev in use */
+	unsigned long nr_blocks;
 	struct request_queue *queue;
 	struct gendisk *disk;
+	/* Crypto API name of the compression backend */
+	char compressor[CRYPTO_MAX_ALG_NAME];
 	int init_done;
 	/* Prevent concurrent execution of device init and reset */
 	struct mutex init_lock;
@@ -126,7 +202,13 @@ extern unsigned int num_devices;
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+extern const char *zram_backends[];
+
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_compact(struct zram *zram);
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_pageflags flag);
 
 #endif
@@ -0,0 +1,479 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* Handles of all pools come from one cache */
+static struct kmem_cache *zs_handle_cache;
+static unsigned int zs_handle_cache_users;
+static DEFINE_MUTEX(zs_handle_cache_lock);
+
+static unsigned int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Pick the zspage size that leaves the least unused at its tail. For
+ * example, one page holds a single 2080 byte object and wastes 2016
+ * bytes, while two pages hold three of them and waste only 1952.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size / size) * size * 100 / zspage_size;
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Copy @len bytes between @buf and object @idx of @zspage, across a
+ * page boundary if the object straddles one.
+ */
+static void copy_object(struct zspage *zspage, unsigned int idx,
+			void *buf, size_t len, int write)
+{
+	unsigned long offset = idx * zspage->class->size;
+
+	while (len) {
+		struct page *page = zspage->pages[offset >> PAGE_SHIFT];
+		unsigned long page_offset = offset & ~PAGE_MASK;
+		size_t bytes = min_t(size_t, len, PAGE_SIZE - page_offset);
+		void *addr;
+
+		addr = kmap_atomic(page, KM_USER1);
+		if (write)
+			memcpy(addr + page_offset, buf, bytes);
+		else
+			memcpy(buf, addr + page_offset, bytes);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += bytes;
+		offset += bytes;
+		len -= bytes;
+	}
+}
+
+static unsigned int obj_malloc(struct zspage *zspage)
+{
+	unsigned int idx = zspage->free_idx;
+
+	zspage->free_idx = zspage->slots[idx] >> 1;
+	zspage->inuse++;
+
+	return idx;
+}
+
+static void obj_free(struct zspage *zspage, unsigned int idx)
+{
+	zspage->slots[idx] = ((unsigned long)zspage->free_idx << 1) |
+				ZS_SLOT_FREE;
+	zspage->free_idx = idx;
+	zspage->inuse--;
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		if (zspage->pages[i])
+			__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	unsigned int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			class->objs_per_zspage * sizeof(zspage->slots[0]),
+			flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i]) {
+			free_zspage(zspage);
+			return NULL;
+		}
+	}
+
+	/* Chain all slots onto the free list */
+	for (i = 0; i < class->objs_per_zspage - 1; i++)
+		zspage->slots[i] = ((unsigned long)(i + 1) << 1) |
+					ZS_SLOT_FREE;
+	zspage->slots[i] = ((unsigned long)ZS_SLOT_END << 1) | ZS_SLOT_FREE;
+
+	zspage->class = class;
+	zspage->free_idx = 0;
+	INIT_LIST_HEAD(&zspage->list);
+
+	return zspage;
+}
+
+/**
+ * zs_create_pool - Create a memory pool
+ *
+ * Returns NULL on failure.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	unsigned int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->migrate_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+	if (!pool->migrate_buf)
+		goto free_pool;
+
+	mutex_lock(&zs_handle_cache_lock);
+	if (!zs_handle_cache_users)
+		zs_handle_cache = KMEM_CACHE(zs_handle, 0);
+	if (zs_handle_cache)
+		zs_handle_cache_users++;
+	mutex_unlock(&zs_handle_cache_lock);
+
+	if (!zs_handle_cache)
+		goto free_buf;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+						class->size;
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+	}
+
+	spin_lock_init(&pool->lock);
+
+	return pool;
+
+free_buf:
+	kfree(pool->migrate_buf);
+free_pool:
+	kfree(pool);
+	return NULL;
+}
+
+static void destroy_zspage_list(struct list_head *head)
+{
+	unsigned int i;
+	struct zspage *zspage, *tmp;
+
+	list_for_each_entry_safe(zspage, tmp, head, list) {
+		for (i = 0; i < zspage->class->objs_per_zspage; i++) {
+			if (!(zspage->slots[i] & ZS_SLOT_FREE))
+				kmem_cache_free(zs_handle_cache,
+					(void *)zspage->slots[i]);
+		}
+		list_del(&zspage->list);
+		free_zspage(zspage);
+	}
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	unsigned int i;
+
+	if (pool->obj_bytes)
+		pr_debug("zs_destroy_pool: %llu bytes still allocated\n",
+			pool->obj_bytes);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		destroy_zspage_list(&pool->classes[i].partial);
+		destroy_zspage_list(&pool->classes[i].full);
+	}
+
+	mutex_lock(&zs_handle_cache_lock);
+	if (!--zs_handle_cache_users) {
+		kmem_cache_destroy(zs_handle_cache);
+		zs_handle_cache = NULL;
+	}
+	mutex_unlock(&zs_handle_cache_lock);
+
+	kfree(pool->migrate_buf);
+	kfree(pool);
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: flags passed to the page allocator when the pool grows
+ *
+ * Returns a handle to pass to zs_obj_read/write() and zs_free(),
+ * or 0 on failure.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+
+	class = &pool->classes[get_size_class_index(size)];
+
+	spin_lock(&pool->lock);
+	if (list_empty(&class->partial)) {
+		/* Page allocation can sleep, grow the class unlocked */
+		spin_unlock(&pool->lock);
+		zspage = alloc_zspage(class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+
+		spin_lock(&pool->lock);
+		list_add(&zspage->list, &class->partial);
+		pool->total_pages += class->pages_per_zspage;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	handle->zspage = zspage;
+	handle->idx = obj_malloc(zspage);
+	zspage->slots[handle->idx] = (unsigned long)handle;
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+
+	pool->obj_bytes += class->size;
+	spin_unlock(&pool->lock);
+
+	return (unsigned long)handle;
+}
+
+/*
+ * Free block identified with <handle>. The zspage holding it is given
+ * back to the system as soon as its last object goes.
+ */
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	spin_lock(&pool->lock);
+	zspage = handle->zspage;
+	class = zspage->class;
+
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move_tail(&zspage->list, &class->partial);
+
+	obj_free(zspage, handle->idx);
+	pool->obj_bytes -= class->size;
+
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		pool->total_pages -= class->pages_per_zspage;
+	} else {
+		zspage = NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	if (zspage)
+		free_zspage(zspage);
+	kmem_cache_free(zs_handle_cache, handle);
+}
+
+/*
+ * Objects may be moved by zs_compact() at any time, so they are only
+ * accessed through these two under the pool lock.
+ */
+void zs_obj_read(struct zs_pool *pool, unsigned long obj,
+			void *dst, size_t len)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	spin_lock(&pool->lock);
+	copy_object(handle->zspage, handle->idx, dst, len, 0);
+	spin_unlock(&pool->lock);
+}
+
+void zs_obj_write(struct zs_pool *pool, unsigned long obj,
+			const void *src, size_t len)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+
+	spin_lock(&pool->lock);
+	copy_object(handle->zspage, handle->idx, (void *)src, len, 1);
+	spin_unlock(&pool->lock);
+}
+
+static struct zspage *find_fullest_zspage(struct size_class *class)
+{
+	struct zspage *zspage, *fullest = NULL;
+
+	list_for_each_entry(zspage, &class->partial, list) {
+		if (!fullest || zspage->inuse > fullest->inuse)
+			fullest = zspage;
+	}
+
+	return fullest;
+}
+
+/*
+ * Move all objects of the sparsest partial zspage of @class into the
+ * fullest ones and queue it on @free_list. Returns the number of pages
+ * that will be freed, 0 once the class is as dense as it gets.
+ * Called with pool->lock held.
+ */
+static unsigned int compact_class(struct zs_pool *pool,
+			struct size_class *class, struct list_head *free_list)
+{
+	unsigned int idx, dst_idx, free_slots = 0;
+	struct zspage *zspage, *src = NULL, *dst = NULL;
+	struct zs_handle *handle;
+
+	list_for_each_entry(zspage, &class->partial, list) {
+		free_slots += class->objs_per_zspage - zspage->inuse;
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	if (!src)
+		return 0;
+
+	/* The other partial zspages must be able to take every object */
+	free_slots -= class->objs_per_zspage - src->inuse;
+	if (free_slots < src->inuse)
+		return 0;
+
+	list_del(&src->list);
+	for (idx = 0; src->inuse; idx++) {
+		if (src->slots[idx] & ZS_SLOT_FREE)
+			continue;
+
+		if (!dst)
+			dst = find_fullest_zspage(class);
+
+		handle = (struct zs_handle *)src->slots[idx];
+		copy_object(src, idx, pool->migrate_buf, class->size, 0);
+		dst_idx = obj_malloc(dst);
+		copy_object(dst, dst_idx, pool->migrate_buf, class->size, 1);
+		dst->slots[dst_idx] = (unsigned long)handle;
+		handle->zspage = dst;
+		handle->idx = dst_idx;
+		obj_free(src, idx);
+
+		if (dst->inuse == class->objs_per_zspage) {
+			list_move(&dst->list, &class->full);
+			dst = NULL;
+		}
+	}
+
+	list_add(&src->list, free_list);
+	pool->total_pages -= class->pages_per_zspage;
+
+	return class->pages_per_zspage;
+}
+
+/**
+ * zs_compact - Release sparsely used zspages of the pool
+ * @pool: pool to compact
+ *
+ * Objects are moved out of the least used zspages of each class for
+ * as long as the rest of the class has room for them. May sleep.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned int i, freed;
+	unsigned long pages_freed = 0;
+	struct zspage *zspage, *tmp;
+	LIST_HEAD(free_list);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		do {
+			spin_lock(&pool->lock);
+			freed = compact_class(pool, &pool->classes[i],
+						&free_list);
+			spin_unlock(&pool->lock);
+
+			pages_freed += freed;
+			cond_resched();
+		} while (freed);
+	}
+
+	list_for_each_entry_safe(zspage, tmp, &free_list, list) {
+		list_del(&zspage->list);
+		free_zspage(zspage);
+	}
+
+	return pages_freed;
+}
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	u64 npages;
+
+	spin_lock(&pool->lock);
+	npages = pool->total_pages;
+	spin_unlock(&pool->lock);
+
+	return npages << PAGE_SHIFT;
+}
+
+/*
+ * Bytes of pool pages not backing any object: free slots plus the
+ * unused tail of each zspage. Compaction reclaims most of the former.
+ */
+u64 zs_get_wasted_bytes(struct zs_pool *pool)
+{
+	u64 wasted;
+
+	spin_lock(&pool->lock);
+	wasted = (pool->total_pages << PAGE_SHIFT) - pool->obj_bytes;
+	spin_unlock(&pool->lock);
+
+	return wasted;
+}
@@ -0,0 +1,83 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/* Must be a multiple of sizeof(unsigned long) */
+#define ZS_MIN_ALLOC_SIZE	32
+
+/* Size classes are separated by this many bytes */
+#define ZS_SIZE_CLASS_DELTA	32
+
+/*
+ * A zspage groups up to this many 0-order pages. Objects are packed
+ * back to back and may straddle two of its pages, so a class whose size
+ * does not divide PAGE_SIZE can still fill its zspage almost entirely.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* End of user params */
+
+#define ZS_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+				/ ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A used slot holds its handle pointer. A free slot holds the index of
+ * the next free slot shifted left by one, with bit 0 set.
+ */
+#define ZS_SLOT_FREE	1UL
+#define ZS_SLOT_END	0xffff
+
+/*
+ * What zs_malloc() hands out. Compaction moves the object and updates
+ * the handle, so the value the caller holds never changes.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	unsigned int idx;
+};
+
+struct zspage {
+	struct size_class *class;
+	struct list_head list;		/* on class partial or full list */
+	unsigned int inuse;		/* objects allocated */
+	unsigned int free_idx;		/* first free slot or ZS_SLOT_END */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long slots[0];
+};
+
+struct size_class {
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	struct list_head partial;	/* zspages with free slots */
+	struct list_head full;
+};
+
+struct zs_pool {
+	spinlock_t lock;
+	struct size_class classes[ZS_SIZE_CLASSES];
+
+	/* Objects moved by compaction are staged here */
+	void *migrate_buf;
+
+	u64 total_pages;
+	u64 obj_bytes;			/* class sized bytes of live objects */
+};
+
+#endif
@@ -46,6 +46,9 @@
 
 #define TINYFSR_PROC_DIR	"tinyFSR"
 
+/* read window size of a BML block device, the default readahead */
+#define BML_WINDOW_SECTORS	((128 * 1024) >> SECTOR_BITS)
+
 extern struct semaphore fsr_mutex;
 
 FSRVolSpec *fsr_get_vol_spec(u32 volume);
@@ -231,18 +234,24 @@ static inline unsigned int fsr_stl_page_size(stl_info_t *ssp)
 #include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0)
 #include <linux/blkdev.h>
+#include <linux/mutex.h>
 
 struct fsr_dev 
 {
-	struct request		*req;        
 	struct list_head	list;
 	int			size;
 	spinlock_t		lock;
 	struct request_queue	*queue;
 	struct gendisk		*gd;
 	int			dev_id;
-	struct scatterlist	*sg;
+	/* read window, whole virtual pages read by one FSR_BML_Read() */
+	char			*rbuf;
+	sector_t		rbuf_start;
+	u32			rbuf_nsect;
+	struct mutex		rbuf_lock;
 };
+
+void bml_invalidate_window(struct fsr_dev *dev);
 #else
 /* Kernel 2.4 */
 #ifndef __user
@@ -12,7 +12,7 @@
  * @version	LinuStoreIII_1.2.0_b038-FSR_1.2.1p1_b139_RTM
  * @file        drivers/tfsr/tfsr_blkdev.c
  * @brief       This file is BML I/O part which supports linux kernel 2.6
- *              It provides (un)registering block device, request function
+ *              It provides (un)registering block device, make_request function
  *
 */
 
@@ -20,6 +20,9 @@
 #include <linux/fs.h>
 #include <linux/version.h>
 #include <linux/proc_fs.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 15)
 #include <linux/platform_device.h>
 #else
@@ -53,50 +56,46 @@ EXPORT_SYMBOL(bml_module_resume);
 #endif /* end of CONFIG_PM */
 
 /**
- * transger data from BML to buffer cache
- * @param volume        : device number
- * @param partno        : 0~15: partition, other: whole device
- * @param req           : request description
- * @return              1 on success, 0 on failure
+ * fill the read window of the device with whole virtual pages
+ * @param dev           fsr block device
+ * @param sector        first sector which should be in the window
+ * @param nsect         number of sectors of the current segment
+ * @param left          number of sectors left in the bio, from sector on
+ * @return              0 on success, otherwise on failure
  *
- * It will erase a block before it do write the data
+ * Only the current segment has to be in the window for a hit. On a miss
+ * everything left in the bio, up to the window size, is fetched by one
+ * FSR_BML_Read() call. A read which continues the previous window is
+ * grown to the full window size, so sequential streams get readahead
+ * sized transfers.
  */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-static int bml_transfer(u32 volume, u32 partno, struct request *req, u32 data_len)
-#else
-static int bml_transfer(u32 volume, u32 partno, struct request *req)
-#endif
+static int bml_fill_window(struct fsr_dev *dev, sector_t sector, u32 nsect,
+		u32 left)
 {
-	unsigned long sector, nsect;
-	char *buf;
+	u32 minor, volume, partno;
+	u32 nPgsPerUnit = 0, n1stVpn = 0, spp_shift, spp_mask;
+	sector_t start, end, capacity;
 	FSRVolSpec *vs;
 	FSRPartI *ps;
-	u32 nPgsPerUnit = 0, n1stVpn = 0, spp_shift, spp_mask;
 	int ret;
-	
-	DEBUG(DL3,"TINY[I]: volume(%d), partno(%d)\n", volume, partno);
 
-	if (req == NULL || (req->cmd_type != REQ_TYPE_FS)) {
-		printk (KERN_NOTICE "Skip non-CMD request\n");
-		__blk_end_request_all(req, -EIO);
-		return -EIO;
-	}
+	/* hit */
+	if (dev->rbuf_nsect && sector >= dev->rbuf_start &&
+	    sector + nsect <= dev->rbuf_start + dev->rbuf_nsect)
+		return 0;
+
+	minor = dev->gd->first_minor;
+	volume = fsr_vol(minor);
+	partno = fsr_part(minor);
+
+	DEBUG(DL3,"TINY[I]: volume(%d), partno(%d)\n", volume, partno);
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	sector = blk_rq_pos(req);
-	nsect = data_len >> 9;
-#else
-	sector = req->sector;
-	nsect = req->current_nr_sectors;
-#endif
-	buf = req->buffer;
-	
 	vs = fsr_get_vol_spec(volume);
 	ps = fsr_get_part_spec(volume);
 	spp_shift = ffs(vs->nSctsPerPg) - 1;
 	spp_mask = vs->nSctsPerPg - 1;
-	
-	if(!fsr_is_whole_dev(partno))
+
+	if (!fsr_is_whole_dev(partno))
 	{
 		if (FSR_BML_GetVirUnitInfo(volume, 
 			fsr_part_start(ps, partno), &n1stVpn, &nPgsPerUnit) 
@@ -107,152 +106,128 @@ static int bml_transfer(u32 volume, u32 partno, struct request *req)
 		}
 	}
 
-	switch (rq_data_dir(req)) 
+	/* sequential access, read ahead a whole window */
+	if (dev->rbuf_nsect && sector == dev->rbuf_start + dev->rbuf_nsect)
+		left = BML_WINDOW_SECTORS;
+
+	start = sector & ~((sector_t) spp_mask);
+	end = (sector + left + spp_mask) & ~((sector_t) spp_mask);
+	if (end - start > BML_WINDOW_SECTORS)
+		end = start + BML_WINDOW_SECTORS;
+	/* only whole pages are read, so the window never claims a partial one */
+	capacity = get_capacity(dev->gd) & ~((sector_t) spp_mask);
+	if (end > capacity)
+		end = capacity;
+	if (end < sector + nsect)
 	{
-		case READ:
-			/*
-			 * If sector and nsect are aligned with vs->nSctsPerPg,
-			 * you have to use a FSR_BML_Read() function using page unit,
-			 * If not, use a FSR_BML_ReadScts() function using sector unit.
-			 */
-			if ((!(sector & spp_mask) && !(nsect & spp_mask))) 
-			{
-				ret = FSR_BML_Read(volume, n1stVpn + (sector >> spp_shift),
-						nsect >> spp_shift, buf, NULL, FSR_BML_FLAG_ECC_ON);
-			} 
-			else 
-			{
-				ret = FSR_BML_ReadScts(volume, n1stVpn + (sector >> spp_shift),
-						sector & spp_mask, nsect, buf, NULL, FSR_BML_FLAG_ECC_ON);
-			}
-			break;
-		default:
-			ERRPRINTK("Unknown request 0x%x\n", (u32) rq_data_dir(req));
-			return -EINVAL;
+		ERRPRINTK("TINY: sector %llu is not in a whole page\n",
+			(unsigned long long) sector);
+		return -EIO;
 	}
 
+	dev->rbuf_nsect = 0;
+	ret = FSR_BML_Read(volume, n1stVpn + (start >> spp_shift),
+			(end - start) >> spp_shift, dev->rbuf, NULL,
+			FSR_BML_FLAG_ECC_ON);
 	/* I/O error */
 	if (ret != FSR_BML_SUCCESS) 
 	{
 		ERRPRINTK("TINY: transfer error = %X\n", ret);
 		return -EIO;
 	}
-	
+
+	dev->rbuf_start = start;
+	dev->rbuf_nsect = end - start;
+
 	DEBUG(DL3,"TINY[O]: volume(%d), partno(%d)\n", volume, partno);
 
-	return 1;
+	return 0;
 }
 
 /**
- * request function which is do read/write sector
- * @param rq    : request queue which is created by blk_init_queue()
- * @return              none
+ * make_request function which reads the sectors of a bio
+ * @param q     : request queue which is created by blk_alloc_queue()
+ * @param bio   : bio to be transferred
+ * @return              0, the bio is always completed here
+ *
+ * Bios bypass the elevator. Adjacent bios are served from the read window
+ * filled by the previous one, so they cost one NAND command in total.
  */
-static void bml_request(struct request_queue *rq)
+static int bml_make_request(struct request_queue *q, struct bio *bio)
 {
-	u32 minor, volume, partno, spp_mask;
-	struct request *req;
-	struct fsr_dev *dev;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25)
-	int ret;
-#endif
-	int trans_ret;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	int error = 0;
-	u32 len = 0;
-#endif
-
-	FSRVolSpec *vs;
-
-	DEBUG(DL3,"TINY[I]\n");
+	struct fsr_dev *dev = q->queuedata;
+	struct bio_vec *bvec;
+	sector_t sector = bio->bi_sector;
+	u32 left = bio_sectors(bio);
+	char *dst;
+	int i, error = 0;
+
+	if (bio_data_dir(bio) != READ)
+	{
+		/* never serve stale data for a range something tried to write */
+		mutex_lock(&dev->rbuf_lock);
+		if (dev->rbuf_nsect && sector < dev->rbuf_start + dev->rbuf_nsect &&
+		    sector + left > dev->rbuf_start)
+			dev->rbuf_nsect = 0;
+		mutex_unlock(&dev->rbuf_lock);
+
+		ERRPRINTK("Unknown request 0x%x\n", (u32) bio_data_dir(bio));
+		bio_endio(bio, -EIO);
+		return 0;
+	}
 
-	dev = rq->queuedata;
-	if (dev->req)
-		return;
+	if (sector + left > get_capacity(dev->gd))
+	{
+		ERRPRINTK("TINY: read beyond end of device\n");
+		bio_endio(bio, -EIO);
+		return 0;
+	}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-	while ((dev->req = req = blk_peek_request(rq)) != NULL)
-#else
-	while ((dev->req = req = elv_next_request(rq)) != NULL) 
-#endif
+	mutex_lock(&dev->rbuf_lock);
+	/* the window is only allocated once the partition is read */
+	if (!dev->rbuf)
+		dev->rbuf = vmalloc(BML_WINDOW_SECTORS << SECTOR_BITS);
+	if (!dev->rbuf)
 	{
-		spin_unlock_irq(rq->queue_lock);
-		
-		minor = dev->gd->first_minor;
-		volume = fsr_vol(minor);
-		partno = fsr_part(minor);
-		vs = fsr_get_vol_spec(volume);
-		spp_mask = vs->nSctsPerPg - 1;
-		
-		DEBUG(DL3,"TINY[I]: volume(%d), partno(%d)\n", volume, partno);
+		mutex_unlock(&dev->rbuf_lock);
+		bio_endio(bio, -ENOMEM);
+		return 0;
+	}
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-		len = blk_rq_cur_bytes(req);
-		if (!( blk_rq_pos(req) & spp_mask) && ( blk_rq_cur_sectors(req) != blk_rq_sectors(req)))
-		{
-			blk_rq_map_sg(rq, req, dev->sg);
-			if (!((dev->sg->length >> SECTOR_BITS) & 0x7))
-			{
-				len = dev->sg->length;
-			}
-			if (len > blk_rq_bytes(req))
-			{
-				len = blk_rq_bytes(req);
-			}
+	bio_for_each_segment(bvec, bio, i)
+	{
+		error = bml_fill_window(dev, sector,
+				bvec->bv_len >> SECTOR_BITS, left);
+		if (error)
+			break;
 
-		}
-		trans_ret = bml_transfer(volume, partno, req, len);
-#else
-		if (!(req->sector & spp_mask) && (req->current_nr_sectors != req->nr_sectors))
-		{
-			blk_rq_map_sg(rq, req, dev->sg);
-			if (!((dev->sg->length >> SECTOR_BITS) & 0x7))
-			{
-				req->current_nr_sectors = dev->sg->length >> SECTOR_BITS;
-			}
-			if (req->current_nr_sectors > req->nr_sectors)
-			{
-				req->current_nr_sectors = req->nr_sectors;
-			}
-		}
-		trans_ret = bml_transfer(volume, partno, req);
-#endif
-		
-		spin_lock_irq(rq->queue_lock);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-		if (trans_ret)
-		{
-			error = 0;
-		} else
-		{
-			error = -EIO;
-		}
-		/* don't need to check if request is finished */
-		if (blk_rq_sectors(req) <= (len >> 9))
-			list_del_init(&req->queuelist);
-		__blk_end_request(req, error, len);
-
-#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 25)
-		req->hard_cur_sectors = req->current_nr_sectors;
-		end_request(req, trans_ret);
-#else	
-		ret = end_that_request_chunk(req, trans_ret, req->current_nr_sectors << SECTOR_BITS);
-		if (!ret)
-		{
-			add_disk_randomness(req->rq_disk);
-			blkdev_dequeue_request(req);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 16)
-			end_that_request_last(req, trans_ret);
-#else
-			end_that_request_last(req);
-#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 16) */
-		}
-#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 25) */
+		dst = kmap_atomic(bvec->bv_page, KM_USER0);
+		memcpy(dst + bvec->bv_offset,
+			dev->rbuf + ((sector - dev->rbuf_start) << SECTOR_BITS),
+			bvec->bv_len);
+		kunmap_atomic(dst, KM_USER0);
+		flush_dcache_page(bvec->bv_page);
 
-		DEBUG(DL3,"TINY[O]: volume(%d), partno(%d)\n", volume, partno);
+		sector += bvec->bv_len >> SECTOR_BITS;
+		left -= bvec->bv_len >> SECTOR_BITS;
 	}
+	mutex_unlock(&dev->rbuf_lock);
 
-	DEBUG(DL3,"TINY[O]\n");
+	bio_endio(bio, error);
+
+	return 0;
+}
+
+/**
+ * drop the read window of a device
+ * @param dev           fsr block device
+ * @return              none
+ */
+void bml_invalidate_window(struct fsr_dev *dev)
+{
+	mutex_lock(&dev->rbuf_lock);
+	dev->rbuf_nsect = 0;
+	mutex_unlock(&dev->rbuf_lock);
 }
 
 /**
@@ -280,48 +255,27 @@ static int bml_add_disk(u32 volume, u32 partno)
 	
 	spin_lock_init(&dev->lock);
 	INIT_LIST_HEAD(&dev->list);
-	down(&bml_list_mutex);
-	list_add(&dev->list, &bml_list);
-	up(&bml_list_mutex);
 	
-	/* init queue */
-	dev->queue = blk_init_queue(bml_request, &dev->lock);
-	dev->queue->queuedata = dev;
-	dev->req = NULL;
-
-	/* alloc scatterlist */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 34)
-	dev->sg = kmalloc(sizeof(struct scatterlist) * dev->queue->limits.max_segments, GFP_KERNEL);
-#else
-	dev->sg = kmalloc(sizeof(struct scatterlist) * dev->queue->limits.max_phys_segments, GFP_KERNEL);
-#endif
-#else
-	dev->sg = kmalloc(sizeof(struct scatterlist) * dev->queue->max_phys_segments, GFP_KERNEL);
-#endif
-	if (!dev->sg)
+	/* init queue, bios are handled without the elevator */
+	dev->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!dev->queue)
 	{
 		kfree(dev);
 		return -ENOMEM;
 	}
+	blk_queue_make_request(dev->queue, bml_make_request);
+	blk_queue_max_hw_sectors(dev->queue, BML_WINDOW_SECTORS);
+	dev->queue->queuedata = dev;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 31)
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 34)
-	memset(dev->sg, 0, sizeof(struct scatterlist) * dev->queue->limits.max_segments);
-#else
-	memset(dev->sg, 0, sizeof(struct scatterlist) * dev->queue->limits.max_phys_segments);
-#endif
-#else
-	memset(dev->sg, 0, sizeof(struct scatterlist) * dev->queue->max_phys_segments);
-#endif
+	/* the read window itself is allocated by the first read */
+	mutex_init(&dev->rbuf_lock);
 
 	/* Each partition is a physical disk which has one partition */
 	dev->gd = alloc_disk(1);
 	/* memory error */
 	if (!dev->gd) 
 	{
-		kfree(dev->sg);
-		list_del(&dev->list);
+		blk_cleanup_queue(dev->queue);
 		kfree(dev);
 		ERRPRINTK("No gendisk in DEV\r\n");
 		return -ENOMEM;
@@ -355,6 +309,10 @@ static int bml_add_disk(u32 volume, u32 partno)
 	/* setup block device parameter array */
 	set_capacity(dev->gd, sectors);
 	
+	down(&bml_list_mutex);
+	list_add(&dev->list, &bml_list);
+	up(&bml_list_mutex);
+
 	add_disk(dev->gd);
 	
 	DEBUG(DL3,"TINY[O]: volume(%d), partno(%d)\n", volume, partno);
@@ -378,13 +336,15 @@ static void bml_del_disk(struct fsr_dev *dev)
 		put_disk(dev->gd);
 	}
 
-	kfree(dev->sg);
+	vfree(dev->rbuf);
 
 	if (dev->queue)
 	{
 		blk_cleanup_queue(dev->queue);
 	}
+	down(&bml_list_mutex);
 	list_del(&dev->list);
+	up(&bml_list_mutex);
 	kfree(dev);
 
 	DEBUG(DL3,"TINY[O]\n");
@@ -456,13 +416,15 @@ static int bml_blkdev_create(void)
 static void bml_blkdev_free(void)
 {
 	struct fsr_dev *dev;
-	struct list_head *this, *next;
 	
 	down(&bml_list_mutex);
-	list_for_each_safe(this, next, &bml_list) 
+	while (!list_empty(&bml_list))
 	{
-		dev = list_entry(this, struct fsr_dev, list);
+		dev = list_first_entry(&bml_list, struct fsr_dev, list);
+		/* bml_del_disk() takes the list mutex itself */
+		up(&bml_list_mutex);
 		bml_del_disk(dev);
+		down(&bml_list_mutex);
 	}
 	up(&bml_list_mutex);
 }
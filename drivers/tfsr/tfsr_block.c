@@ -80,6 +80,8 @@ static int bml_block_release(struct gendisk *disk, fmode_t mode)
 	u32 volume, minor;
 
 	minor = disk->first_minor;
+	/* the window must not outlive the user of the volume */
+	bml_invalidate_window(disk->queue->queuedata);
 #else
 static int bml_block_release(struct inode *inode, struct file *file)
 {
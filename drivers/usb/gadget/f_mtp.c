@@ -36,7 +36,8 @@
 #include <linux/usb/ch9.h>
 #include <linux/usb/f_mtp.h>
 
-#define MTP_BULK_BUFFER_SIZE       16384
+#define MTP_BULK_BUFFER_SIZE       65536
+#define MTP_BULK_BUFFER_SIZE_MIN   16384
 #define INTR_BUFFER_SIZE           28
 
 /* String IDs */
@@ -50,8 +51,9 @@
 #define STATE_ERROR                 4   /* error from completion routine */
 
 /* number of tx and rx requests to allocate */
-#define TX_REQ_MAX 4
-#define RX_REQ_MAX 2
+#define TX_REQ_DEFAULT 8
+#define RX_REQ_DEFAULT 4
+#define RX_REQ_MAX 8
 #define INTR_REQ_MAX 5
 
 /* ID for Microsoft MTP OS String */
@@ -69,6 +71,27 @@
 
 static const char mtp_shortname[] = "mtp_usb";
 
+/*
+ * Bulk requests are allocated once at bind time.  If the larger buffers
+ * cannot be had we fall back to MTP_BULK_BUFFER_SIZE_MIN, and the values
+ * below are updated to what was actually allocated.
+ */
+static unsigned int mtp_tx_req_len = MTP_BULK_BUFFER_SIZE;
+module_param(mtp_tx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_req_len, "MTP bulk IN request size in bytes");
+
+static unsigned int mtp_tx_reqs = TX_REQ_DEFAULT;
+module_param(mtp_tx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_tx_reqs, "Number of MTP bulk IN requests");
+
+static unsigned int mtp_rx_req_len = MTP_BULK_BUFFER_SIZE;
+module_param(mtp_rx_req_len, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_req_len, "MTP bulk OUT request size in bytes");
+
+static unsigned int mtp_rx_reqs = RX_REQ_DEFAULT;
+module_param(mtp_rx_reqs, uint, S_IRUGO);
+MODULE_PARM_DESC(mtp_rx_reqs, "Number of MTP bulk OUT requests (2-8)");
+
 struct mtp_dev {
 	struct usb_function function;
 	struct usb_composite_dev *cdev;
@@ -428,18 +451,42 @@ static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 	ep->driver_data = dev;		/* claim the endpoint */
 	dev->ep_intr = ep;
 
+	/* whole packets only, so only the last packet of a transfer is short */
+	mtp_tx_req_len = max_t(unsigned int, rounddown(mtp_tx_req_len, 512),
+			MTP_BULK_BUFFER_SIZE_MIN);
+	mtp_rx_req_len = max_t(unsigned int, rounddown(mtp_rx_req_len, 512),
+			MTP_BULK_BUFFER_SIZE_MIN);
+	mtp_tx_reqs = max(mtp_tx_reqs, 1U);
+	mtp_rx_reqs = clamp_t(unsigned int, mtp_rx_reqs, 2, RX_REQ_MAX);
+
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+retry_tx_alloc:
+	for (i = 0; i < mtp_tx_reqs; i++) {
+		req = mtp_request_new(dev->ep_in, mtp_tx_req_len);
+		if (!req) {
+			if (mtp_tx_req_len == MTP_BULK_BUFFER_SIZE_MIN)
+				goto fail;
+			while ((req = mtp_req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			mtp_tx_req_len = MTP_BULK_BUFFER_SIZE_MIN;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		mtp_req_put(dev, &dev->tx_idle, req);
 	}
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+retry_rx_alloc:
+	for (i = 0; i < mtp_rx_reqs; i++) {
+		req = mtp_request_new(dev->ep_out, mtp_rx_req_len);
+		if (!req) {
+			if (mtp_rx_req_len == MTP_BULK_BUFFER_SIZE_MIN)
+				goto fail;
+			while (i--) {
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+				dev->rx_req[i] = NULL;
+			}
+			mtp_rx_req_len = MTP_BULK_BUFFER_SIZE_MIN;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
@@ -469,7 +516,7 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > MTP_BULK_BUFFER_SIZE)
+	if (count > mtp_rx_req_len)
 		return -EINVAL;
 
 	/* we will block until we're online */
@@ -589,8 +636,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > mtp_tx_req_len)
+			xfer = mtp_tx_req_len;
 		else
 			xfer = count;
 		if (xfer && copy_from_user(req->buf, buf, xfer)) {
@@ -681,8 +728,8 @@ static void send_file_work(struct work_struct *data) {
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > mtp_tx_req_len)
+			xfer = mtp_tx_req_len;
 		else
 			xfer = count;
 
@@ -732,11 +779,11 @@ static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev	*dev = container_of(data, struct mtp_dev, receive_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count, unqueued;
+	int ret, head = 0, tail = 0, pending = 0, depth;
 	int r = 0;
 
 	/* read our parameters */
@@ -747,62 +794,72 @@ static void receive_file_work(struct work_struct *data)
 
 	DBG(cdev, "receive_file_work(%lld)\n", count);
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
-
-			read_req->length = (count > MTP_BULK_BUFFER_SIZE
-					? MTP_BULK_BUFFER_SIZE : count);
-			dev->rx_done = 0;
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+	/* if xfer_file_length is 0xFFFFFFFF, then we read until
+	 * we get a zero length packet.  We cannot tell where such a
+	 * transfer ends, so only keep one read queued for it.
+	 */
+	depth = (count == 0xFFFFFFFF) ? 1 : mtp_rx_reqs;
+	unqueued = count;
+
+	while (count > 0) {
+		/* keep the OUT endpoint busy while we write to the file */
+		while (unqueued > 0 && pending < depth) {
+			req = dev->rx_req[head];
+			req->length = (unqueued > mtp_rx_req_len
+					? mtp_rx_req_len : unqueued);
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				dev->state = STATE_ERROR;
-				break;
+				goto done;
 			}
+			head = (head + 1) % mtp_rx_reqs;
+			pending++;
+			if (count != 0xFFFFFFFF)
+				unqueued -= req->length;
 		}
 
-		if (write_req) {
-			DBG(cdev, "rx %p %d\n", write_req, write_req->actual);
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			DBG(cdev, "vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				dev->state = STATE_ERROR;
-				break;
-			}
-			write_req = NULL;
+		/* wait for the oldest read to complete */
+		req = dev->rx_req[tail];
+		ret = wait_event_interruptible(dev->read_wq,
+			req->status != -EINPROGRESS || dev->state != STATE_BUSY);
+		if (dev->state == STATE_CANCELED) {
+			r = -ECANCELED;
+			goto done;
+		}
+		if (req->status != 0 || dev->state != STATE_BUSY) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			goto done;
+		}
+		tail = (tail + 1) % mtp_rx_reqs;
+		pending--;
+
+		if (count != 0xFFFFFFFF)
+			count -= req->actual;
+		if (req->actual < req->length) {
+			/* short packet is used to signal EOF for sizes > 4 gig */
+			DBG(cdev, "got short packet\n");
+			count = 0;
 		}
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (dev->state == STATE_CANCELED) {
-				r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
-			}
-			/* if xfer_file_length is 0xFFFFFFFF, then we read until
-			 * we get a zero length packet
-			 */
-			if (count != 0xFFFFFFFF)
-				count -= read_req->actual;
-			if (read_req->actual < read_req->length) {
-				/* short packet is used to signal EOF for sizes > 4 gig */
-				DBG(cdev, "got short packet\n");
-				count = 0;
-			}
-
-			write_req = read_req;
-			read_req = NULL;
+		DBG(cdev, "rx %p %d\n", req, req->actual);
+		ret = vfs_write(filp, req->buf, req->actual, &offset);
+		DBG(cdev, "vfs_write %d\n", ret);
+		if (ret != req->actual) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			goto done;
 		}
 	}
 
+done:
+	/* take back whatever is still queued after an error or short packet */
+	while (pending--) {
+		usb_ep_dequeue(dev->ep_out, dev->rx_req[tail]);
+		tail = (tail + 1) % mtp_rx_reqs;
+	}
+
 	DBG(cdev, "receive_file_work returning %d\n", r);
 	/* write the result */
 	dev->xfer_result = r;
@@ -92,6 +92,20 @@ static inline void s3c_udc_pre_setup(void)
 	writel(ep_ctrl|DEPCTL_EPENA|DEPCTL_CNAK, S3C_UDC_OTG_DOEPCTL(EP0_CON));
 }
 
+/*
+ * DxEPTSIZ only holds a 10 bit packet count and a 19 bit transfer size,
+ * so requests longer than that are moved in several DMA transfers of
+ * whole packets.
+ */
+static inline u32 dma_xfer_len(struct s3c_ep *ep, u32 length)
+{
+	u32 maxpacket = ep->ep.maxpacket;
+	u32 max = min_t(u32, DEPTSIZ_PKT_CNT_MAX,
+			DEPTSIZ_XFER_SIZE_MASK / maxpacket) * maxpacket;
+
+	return min(length, max);
+}
+
 static int setdma_rx(struct s3c_ep *ep, struct s3c_request *req)
 {
 	u32 *buf, ctrl;
@@ -102,7 +116,7 @@ static int setdma_rx(struct s3c_ep *ep, struct s3c_request *req)
 	buf = req->req.buf + req->req.actual;
 	prefetchw(buf);
 
-	length = req->req.length - req->req.actual;
+	length = dma_xfer_len(ep, req->req.length - req->req.actual);
 	req->req.dma = dma_map_single(dev, buf,
 			length, DMA_FROM_DEVICE);
 	req->mapped = 1;
@@ -138,7 +152,7 @@ static int setdma_tx(struct s3c_ep *ep, struct s3c_request *req)
 
 	buf = req->req.buf + req->req.actual;
 	prefetch(buf);
-	length = req->req.length - req->req.actual;
+	length = dma_xfer_len(ep, req->req.length - req->req.actual);
 
 	if (ep_num == EP0_CON)
 		length = min(length, (u32)ep_maxpacket(ep));
@@ -200,11 +214,11 @@ static void complete_rx(struct s3c_udc *dev, u8 ep_num)
 		xfer_size = (ep_tsr & 0x7f);
 
 	else
-		xfer_size = (ep_tsr & 0x7fff);
+		xfer_size = (ep_tsr & DEPTSIZ_XFER_SIZE_MASK);
 
 	__dma_single_cpu_to_dev(req->req.buf, req->req.length, DMA_FROM_DEVICE);
-	xfer_length = req->req.length - xfer_size;
-	req->req.actual += min(xfer_length, req->req.length - req->req.actual);
+	xfer_length = dma_xfer_len(ep, req->req.length - req->req.actual) - xfer_size;
+	req->req.actual += xfer_length;
 	is_short = (xfer_length < ep->ep.maxpacket);
 
 	DEBUG_OUT_EP("%s: RX DMA done : ep = %d, rx bytes = %d/%d, "
@@ -212,7 +226,8 @@ static void complete_rx(struct s3c_udc *dev, u8 ep_num)
 		__func__, ep_num, req->req.actual, req->req.length,
 		is_short, ep_tsr, xfer_size);
 
-	if (is_short || req->req.actual == xfer_length) {
+	if (ep_num == EP0_CON || is_short || xfer_size ||
+	    req->req.actual == req->req.length) {
 		if (ep_num == EP0_CON && dev->ep0state == DATA_STATE_RECV) {
 			DEBUG_OUT_EP("	=> Send ZLP\n");
 			dev->ep0state = WAIT_FOR_SETUP;
@@ -227,6 +242,9 @@ static void complete_rx(struct s3c_udc *dev, u8 ep_num)
 				setdma_rx(ep, req);
 			}
 		}
+	} else {
+		DEBUG_OUT_EP("%s: Rx request continues...\n", __func__);
+		setdma_rx(ep, req);
 	}
 }
 
@@ -260,14 +278,15 @@ static void complete_tx(struct s3c_udc *dev, u8 ep_num)
 
 	ep_tsr = readl(S3C_UDC_OTG_DIEPTSIZ(ep_num));
 
-	if (ep_num == EP0_CON)
+	/* setdma_tx() already counted the whole transfer as sent */
+	if (ep_num == EP0_CON) {
 		xfer_size = (ep_tsr & 0x7f);
-	else
-		xfer_size = (ep_tsr & 0x7fff);
-
-	req->req.actual = req->req.length - xfer_size;
+		req->req.actual = req->req.length - xfer_size;
+	} else {
+		xfer_size = (ep_tsr & DEPTSIZ_XFER_SIZE_MASK);
+		req->req.actual -= xfer_size;
+	}
 	xfer_length = req->req.length - xfer_size;
-	req->req.actual += min(xfer_length, req->req.length - req->req.actual);
 	is_short = (xfer_length < ep->ep.maxpacket);
 
 	DEBUG_IN_EP("%s: TX DMA done : ep = %d, tx bytes = %d/%d, "
@@ -283,6 +302,9 @@ static void complete_tx(struct s3c_udc *dev, u8 ep_num)
 			DEBUG_IN_EP("%s: Next Tx request start...\n", __func__);
 			setdma_tx(ep, req);
 		}
+	} else if (ep_num != EP0_CON && !xfer_size) {
+		DEBUG_IN_EP("%s: Tx request continues...\n", __func__);
+		setdma_tx(ep, req);
 	}
 }
 static inline void s3c_udc_check_tx_queue(struct s3c_udc *dev, u8 ep_num)
@@ -30,6 +30,8 @@
 #include <linux/memory.h>
 #include <linux/cpufreq.h>
 #include <linux/kthread.h>
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
 #include <plat/clock.h>
 #include <plat/cpu-freq.h>
 #include <plat/media.h>
@@ -127,11 +129,86 @@ static int __init s3cfb_draw_logo(struct fb_info *fb)
 	return 0;
 }
 #endif
+/* Called with flip_lock held */
+static int s3cfb_flips_pending(struct s3cfb_global *fbdev)
+{
+	struct s3c_platform_fb *pdata = to_fb_plat(fbdev->dev);
+	struct s3cfb_window *win;
+	int i;
+
+	for (i = 0; i < pdata->nr_wins; i++) {
+		win = fbdev->fb[i]->par;
+		if (win->flip_count || win->flip_programmed != win->flip_done)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Called at the start of each vsync. The shadow registers written at the
+ * previous interrupt have just been latched, so that flip is now on screen
+ * and the next queued one can be written.
+ */
+static void s3cfb_flip_vsync(struct s3cfb_global *fbdev)
+{
+	struct s3c_platform_fb *pdata = to_fb_plat(fbdev->dev);
+	struct s3cfb_window *win;
+	int i;
+
+	spin_lock(&fbdev->flip_lock);
+	for (i = 0; i < pdata->nr_wins; i++) {
+		win = fbdev->fb[i]->par;
+		win->flip_done = win->flip_programmed;
+		if (!win->flip_count)
+			continue;
+
+		fbdev->fb[i]->var.yoffset = win->flip_yoffset[win->flip_head];
+		win->flip_head = (win->flip_head + 1) % S3CFB_MAX_PENDING_FLIPS;
+		win->flip_count--;
+		win->flip_programmed++;
+		s3cfb_set_buffer_address(fbdev, i);
+	}
+
+	/* Userspace turned vsync off while flips were still in flight */
+	if (!fbdev->vsync_user && !s3cfb_flips_pending(fbdev))
+		s3cfb_set_vsync_interrupt(fbdev, 0);
+	spin_unlock(&fbdev->flip_lock);
+}
+
+/* Put the newest queued buffer up right away, the display is going off */
+static void s3cfb_flip_flush(struct s3cfb_global *fbdev)
+{
+	struct s3c_platform_fb *pdata = to_fb_plat(fbdev->dev);
+	struct s3cfb_window *win;
+	unsigned long flags;
+	int i, last;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	for (i = 0; i < pdata->nr_wins; i++) {
+		win = fbdev->fb[i]->par;
+		if (win->flip_count) {
+			last = (win->flip_head + win->flip_count - 1) %
+				S3CFB_MAX_PENDING_FLIPS;
+			fbdev->fb[i]->var.yoffset = win->flip_yoffset[last];
+			s3cfb_set_buffer_address(fbdev, i);
+			win->flip_head = 0;
+			win->flip_count = 0;
+		}
+		win->flip_programmed = win->flip_seq;
+		win->flip_done = win->flip_seq;
+	}
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	wake_up_interruptible(&fbdev->vsync_wq);
+}
+
 static irqreturn_t s3cfb_irq_frame(int irq, void *data)
 {
 	struct s3cfb_global *fbdev = (struct s3cfb_global *)data;
 
 	s3cfb_clear_interrupt(fbdev);
+	s3cfb_flip_vsync(fbdev);
 
 	fbdev->vsync_timestamp = ktime_get();
 	wmb();
@@ -163,6 +240,8 @@ static int s3cfb_init_global(struct s3cfb_global *ctrl)
 	ctrl->rgb_mode = MODE_RGB_P;
 
 	init_waitqueue_head(&ctrl->vsync_wq);
+	spin_lock_init(&ctrl->flip_lock);
+	ctrl->vsync_user = 1;
 	mutex_init(&ctrl->lock);
 
 	s3cfb_set_output(ctrl);
@@ -484,6 +563,7 @@ static int s3cfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *fb)
 	struct s3cfb_window *win = fb->par;
 	struct s3cfb_global *fbdev =
 		platform_get_drvdata(to_platform_device(fb->device));
+	unsigned long flags;
 
 	if (var->yoffset + var->yres > var->yres_virtual) {
 		dev_err(fbdev->dev, "invalid yoffset value\n");
@@ -493,13 +573,15 @@ static int s3cfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *fb)
 	if (win->owner == DMA_MEM_OTHER)
 		fix->smem_start = win->other_mem_addr;
 
-	fb->var.yoffset = var->yoffset;
-
 	dev_dbg(fbdev->dev,
 		"[fb%d] yoffset for pan display: %d\n",
 		win->id, var->yoffset);
 
+	/* Keep the frame interrupt from writing a queued flip in between */
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	fb->var.yoffset = var->yoffset;
 	s3cfb_set_buffer_address(fbdev, win->id);
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
 
 	return 0;
 }
@@ -551,6 +633,31 @@ static int s3cfb_open(struct fb_info *fb, int user)
 
 	return ret;
 }
+/*
+ * Wait until registers written so far have latched, so the memory the
+ * window scanned out before can go. Signals are ignored, the memory must
+ * not be freed early. Without a frame interrupt the timeout still covers
+ * several frames.
+ */
+static void s3cfb_wait_for_latch(struct s3cfb_global *fbdev)
+{
+	ktime_t prev_timestamp = fbdev->vsync_timestamp;
+
+	wait_event_timeout(fbdev->vsync_wq,
+			s3cfb_vsync_timestamp_changed(fbdev, prev_timestamp),
+			msecs_to_jiffies(100));
+}
+
+static void s3cfb_release_win_ion(struct s3cfb_global *fbdev,
+				  struct s3cfb_window *win)
+{
+	if (win->ion) {
+		s5p_ion_free(fbdev->ion_client, win->ion);
+		win->ion = NULL;
+		win->owner = DMA_MEM_NONE;
+	}
+}
+
 static int s3cfb_release_window(struct fb_info *fb)
 {
 	struct s3cfb_global *fbdev =
@@ -562,6 +669,10 @@ static int s3cfb_release_window(struct fb_info *fb)
 		s3cfb_set_window(fbdev, win->id, 0);
 		s3cfb_unmap_video_memory(fb);
 		s3cfb_set_buffer_address(fbdev, win->id);
+		/* The window is scanned out until the disable latches */
+		if (win->ion && fbdev->enabled)
+			s3cfb_wait_for_latch(fbdev);
+		s3cfb_release_win_ion(fbdev, win);
 	}
 
 	win->x = 0;
@@ -607,6 +718,184 @@ static int s3cfb_wait_for_vsync(struct s3cfb_global *ctrl)
 
 	return ret;
 }
+/*
+ * Scan an overlay window out of a shared ion buffer, such as a frame FIMC
+ * has just scaled, instead of copying it into the window's own memory.
+ */
+static int s3cfb_set_win_ion(struct s3cfb_global *fbdev, struct fb_info *fb,
+			     int fd)
+{
+	struct s3c_platform_fb *pdata = to_fb_plat(fbdev->dev);
+	struct fb_fix_screeninfo *fix = &fb->fix;
+	struct s3cfb_window *win = fb->par;
+	struct ion_handle *handle, *old;
+	unsigned long flags;
+	dma_addr_t phys;
+	size_t len;
+
+	/* The console framebuffer keeps its own memory */
+	if (win->id == pdata->default_win)
+		return -EINVAL;
+
+	if (!fbdev->ion_client) {
+		struct ion_client *client = s5p_ion_client_create("s3cfb");
+
+		if (IS_ERR(client))
+			return PTR_ERR(client);
+		fbdev->ion_client = client;
+	}
+
+	handle = s5p_ion_import_fd(fbdev->ion_client, fd, &phys, &len);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	if (len < fix->line_length * fb->var.yres) {
+		s5p_ion_free(fbdev->ion_client, handle);
+		return -EINVAL;
+	}
+
+	if (win->owner == DMA_MEM_FIMD)
+		s3cfb_unmap_video_memory(fb);
+
+	old = win->ion;
+	win->ion = handle;
+	win->owner = DMA_MEM_OTHER;
+	win->other_mem_addr = phys;
+	win->other_mem_size = len;
+	fix->smem_start = phys;
+	fix->smem_len = len;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	fb->var.yoffset = 0;
+	s3cfb_set_buffer_address(fbdev, win->id);
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	/* The old buffer is read until the new address latches */
+	if (old) {
+		s3cfb_wait_for_latch(fbdev);
+		s5p_ion_free(fbdev->ion_client, old);
+	}
+
+	return 0;
+}
+
+struct s3cfb_fence {
+	struct s3cfb_global	*fbdev;
+	struct s3cfb_window	*win;
+	u32			seq;
+};
+
+static int s3cfb_flip_done(struct s3cfb_window *win, u32 seq)
+{
+	rmb();
+	return (s32)(win->flip_done - seq) >= 0;
+}
+
+static unsigned int s3cfb_fence_poll(struct file *file, poll_table *wait)
+{
+	struct s3cfb_fence *fence = file->private_data;
+
+	poll_wait(file, &fence->fbdev->vsync_wq, wait);
+
+	return s3cfb_flip_done(fence->win, fence->seq) ?
+		POLLIN | POLLRDNORM : 0;
+}
+
+static int s3cfb_fence_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+
+	return 0;
+}
+
+static const struct file_operations s3cfb_fence_fops = {
+	.poll		= s3cfb_fence_poll,
+	.release	= s3cfb_fence_release,
+	.llseek		= noop_llseek,
+};
+
+static int s3cfb_flip_slot_free(struct s3cfb_global *fbdev,
+				struct s3cfb_window *win)
+{
+	unsigned long flags;
+	int pending;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	pending = win->flip_count + (win->flip_programmed != win->flip_done);
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	return pending < S3CFB_MAX_PENDING_FLIPS;
+}
+
+/*
+ * Queue a buffer for the next vsync instead of switching at once. Only
+ * blocks when every back buffer is already waiting for the screen.
+ */
+static int s3cfb_queue_flip(struct s3cfb_global *fbdev, struct fb_info *fb,
+			    struct s3cfb_flip *flip, struct file **fence_file)
+{
+	struct s3cfb_window *win = fb->par;
+	struct s3cfb_fence *fence;
+	struct file *file;
+	unsigned long flags;
+	int ret, slot;
+
+	if (flip->yoffset + fb->var.yres > fb->var.yres_virtual)
+		return -EINVAL;
+
+	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	if (!fence)
+		return -ENOMEM;
+	fence->fbdev = fbdev;
+	fence->win = win;
+
+	ret = wait_event_interruptible_timeout(fbdev->vsync_wq,
+			s3cfb_flip_slot_free(fbdev, win),
+			msecs_to_jiffies(100));
+	if (ret == 0)
+		ret = -ETIMEDOUT;
+	if (ret < 0)
+		goto err;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	if (win->flip_count + (win->flip_programmed != win->flip_done) >=
+	    S3CFB_MAX_PENDING_FLIPS) {
+		/* lost the slot to another thread */
+		spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+		ret = -EBUSY;
+		goto err;
+	}
+	slot = (win->flip_head + win->flip_count) % S3CFB_MAX_PENDING_FLIPS;
+	win->flip_yoffset[slot] = flip->yoffset;
+	win->flip_count++;
+	fence->seq = flip->seq = ++win->flip_seq;
+
+	/*
+	 * Flips are applied from the frame interrupt, which stays on
+	 * until the queue has drained
+	 */
+	if (!s3cfb_get_vsync_interrupt(fbdev)) {
+		s3cfb_set_global_interrupt(fbdev, 1);
+		s3cfb_set_vsync_interrupt(fbdev, 1);
+	}
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	/* The flip stays queued even if userspace gets no fence for it */
+	file = anon_inode_getfile("s3cfb_flip", &s3cfb_fence_fops, fence,
+				  O_RDONLY);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto err;
+	}
+	*fence_file = file;
+
+	return 0;
+
+err:
+	kfree(fence);
+	return ret;
+}
+
 static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 {
 	struct s3cfb_global *fbdev =
@@ -616,6 +905,9 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 	struct s3cfb_lcd *lcd = fbdev->lcd;
 	struct fb_fix_screeninfo *fix = &fb->fix;
 	struct s3cfb_next_info next_fb_info;
+	struct file *fence_file;
+	unsigned long flags;
+	int fence_fd;
 
 	int ret = 0;
 
@@ -623,7 +915,9 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 		struct s3cfb_user_window user_window;
 		struct s3cfb_user_plane_alpha user_alpha;
 		struct s3cfb_user_chroma user_chroma;
+		struct s3cfb_flip flip;
 		int vsync;
+		int fd;
 	} p;
 
 	switch (cmd) {
@@ -692,11 +986,54 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 		if (get_user(p.vsync, (int __user *)arg))
 			ret = -EFAULT;
 		else {
+			spin_lock_irqsave(&fbdev->flip_lock, flags);
+			fbdev->vsync_user = p.vsync;
 			if (p.vsync)
 				s3cfb_set_global_interrupt(fbdev, 1);
 
-			s3cfb_set_vsync_interrupt(fbdev, p.vsync);
+			/* queued flips still need the frame interrupt */
+			if (p.vsync || !s3cfb_flips_pending(fbdev))
+				s3cfb_set_vsync_interrupt(fbdev, p.vsync);
+			spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+		}
+		break;
+
+	case S3CFB_QUEUE_FLIP:
+		if (copy_from_user(&p.flip, (struct s3cfb_flip __user *)arg,
+				   sizeof(p.flip))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		/* the fd is only installed once userspace has its number */
+		fence_fd = get_unused_fd_flags(O_CLOEXEC);
+		if (fence_fd < 0) {
+			ret = fence_fd;
+			break;
 		}
+
+		ret = s3cfb_queue_flip(fbdev, fb, &p.flip, &fence_file);
+		if (ret) {
+			put_unused_fd(fence_fd);
+			break;
+		}
+
+		p.flip.fence_fd = fence_fd;
+		if (copy_to_user((struct s3cfb_flip __user *)arg, &p.flip,
+				 sizeof(p.flip))) {
+			put_unused_fd(fence_fd);
+			fput(fence_file);
+			ret = -EFAULT;
+			break;
+		}
+		fd_install(fence_fd, fence_file);
+		break;
+
+	case S3CFB_SET_WIN_ION_FD:
+		if (get_user(p.fd, (int __user *)arg))
+			ret = -EFAULT;
+		else
+			ret = s3cfb_set_win_ion(fbdev, fb, p.fd);
 		break;
 
 	case S3CFB_GET_CURR_FB_INFO:
@@ -1241,6 +1578,7 @@ void s3cfb_early_suspend(struct early_suspend *h)
 #endif
 
 	s3cfb_display_off(fbdev);
+	s3cfb_flip_flush(fbdev);
 #ifdef CONFIG_FB_S3C_MDNIE
 	s3c_mdnie_off();
 #endif
@@ -22,6 +22,7 @@
 #include <linux/earlysuspend.h>
 #endif
 #include <plat/fb.h>
+#include <plat/ion.h>
 #endif
 
 /*
@@ -178,6 +179,13 @@ struct s3cfb_lcd {
 	void	(*deinit_ldi)(void);
 };
 
+/* Flips that may wait for the screen, one buffer is always scanned out */
+#if (CONFIG_FB_S3C_NR_BUFFERS > 2)
+#define S3CFB_MAX_PENDING_FLIPS	(CONFIG_FB_S3C_NR_BUFFERS - 1)
+#else
+#define S3CFB_MAX_PENDING_FLIPS	1
+#endif
+
 /*
  * struct s3cfb_window
  * @id:			window id
@@ -191,6 +199,13 @@ struct s3cfb_lcd {
  * @pseudo_pal:		pseudo palette for fb layer
  * @alpha:		alpha blending structure
  * @chroma:		chroma key structure
+ * @flip_yoffset:	ring of yoffsets queued by S3CFB_QUEUE_FLIP
+ * @flip_head:		oldest entry in the ring
+ * @flip_count:		entries in the ring
+ * @flip_seq:		sequence number of the last flip queued
+ * @flip_programmed:	last flip written to the shadow registers
+ * @flip_done:		last flip scanned out
+ * @ion:		shared buffer scanned out by an overlay window
 */
 struct s3cfb_window {
 	int			id;
@@ -207,6 +222,13 @@ struct s3cfb_window {
 	unsigned int		pseudo_pal[16];
 	struct			s3cfb_alpha alpha;
 	struct			s3cfb_chroma chroma;
+	u32			flip_yoffset[S3CFB_MAX_PENDING_FLIPS];
+	int			flip_head;
+	int			flip_count;
+	u32			flip_seq;
+	u32			flip_programmed;
+	u32			flip_done;
+	struct ion_handle	*ion;
 };
 
 /*
@@ -234,6 +256,9 @@ struct s3cfb_global {
 
 	wait_queue_head_t	vsync_wq;
 	ktime_t			vsync_timestamp;
+	spinlock_t		flip_lock;
+	int			vsync_user;	/* S3CFB_SET_VSYNC_INT setting */
+	struct ion_client	*ion_client;	/* created on first import */
 
 	int			vsync_state;
 	struct task_struct	*vsync_thread;
@@ -283,6 +308,17 @@ struct s3cfb_user_chroma {
 	unsigned char	blue;
 };
 
+/*
+ * Queue @yoffset for the next frame. On return @seq numbers the flip and
+ * @fence_fd polls readable once it is on screen, which is also when the
+ * buffer it replaced may be drawn into again.
+ */
+struct s3cfb_flip {
+	__u32	yoffset;
+	__u32	seq;
+	__s32	fence_fd;
+};
+
 struct s3cfb_next_info {
 	unsigned int phy_start_addr;
 	unsigned int xres;		/* visible resolution*/
@@ -318,6 +354,8 @@ struct s3cfb_next_info {
 #define S3CFB_SET_WIN_ADDR		_IOW('F', 309, unsigned long)
 #define S3CFB_SET_WIN_MEM		_IOW('F', 310, \
 						enum s3cfb_mem_owner_t)
+#define S3CFB_QUEUE_FLIP		_IOWR('F', 311, struct s3cfb_flip)
+#define S3CFB_SET_WIN_ION_FD		_IOW('F', 312, int)
 
 /*
  * E X T E R N S
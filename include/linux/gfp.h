@@ -363,6 +363,13 @@ extern void free_hot_cold_page(struct page *page, int cold);
 #define free_page(addr) free_pages((addr), 0)
 
 void page_alloc_init(void);
+
+#ifdef CONFIG_CMA
+/* The below functions must be run on a range from a single zone. */
+extern int alloc_contig_range(unsigned long start, unsigned long end);
+extern void free_contig_range(unsigned long pfn, unsigned long nr_pages);
+extern void __init init_cma_reserved_pageblock(struct page *page);
+#endif
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp);
 void drain_all_pages(void);
 void drain_local_pages(void *dummy);
@@ -89,6 +89,8 @@ struct sdhci_host {
 #define SDHCI_QUIRK_UNSTABLE_RO_DETECT			(1<<31)
 /* Controller must maintain clock when no activity */
 #define SDHCI_QUIRK_MUST_MAINTAIN_CLOCK			(1ULL<<32)
+/* Controller keeps its DMA engine running after a data error */
+#define SDHCI_QUIRK_DMA_RESET_ON_ERROR			(1ULL<<33)
 
 	int irq;		/* Device IRQ */
 	void __iomem *ioaddr;	/* Mapped address */
@@ -137,6 +139,11 @@ struct sdhci_host {
 
 	int sg_count;		/* Mapped sg entries */
 
+	struct sdhci_next {
+		unsigned int sg_count;	/* Entries mapped by pre_req */
+		s32 cookie;		/* Cookie of the premapped data */
+	} next_data;
+
 	u8 *adma_desc;		/* ADMA descriptor table */
 	u8 *align_buffer;	/* Bounce buffer */
 
@@ -197,6 +197,7 @@ struct onenand_chip {
 #define ONENAND_HAS_4KB_PAGE		(0x0008)
 #define ONENAND_HAS_CACHE_PROGRAM	(0x0010)
 #define ONENAND_SKIP_UNLOCK_CHECK	(0x0100)
+#define ONENAND_NO_OOB_RWL		(0x0200)
 #define ONENAND_PAGEBUF_ALLOC		(0x1000)
 #define ONENAND_OOBBUF_ALLOC		(0x2000)
 #define ONENAND_SKIP_INITIAL_UNLOCKING	(0x4000)
@@ -74,5 +74,37 @@ extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
 extern int sysctl_panic_on_oom;
+
+/*
+ * Android low memory killer: processes are kept in buckets by oom_adj,
+ * under tasklist_lock, and reclaim efficiency decides when to kill.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_adj_add(struct task_struct *p);
+extern void lowmem_adj_del(struct task_struct *p);
+extern void lowmem_adj_replace(struct task_struct *old,
+			       struct task_struct *new);
+extern void lowmem_adj_update(struct task_struct *p);
+extern void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+			      unsigned long reclaimed);
+#else
+static inline void lowmem_adj_add(struct task_struct *p)
+{
+}
+static inline void lowmem_adj_del(struct task_struct *p)
+{
+}
+static inline void lowmem_adj_replace(struct task_struct *old,
+				      struct task_struct *new)
+{
+}
+static inline void lowmem_adj_update(struct task_struct *p)
+{
+}
+static inline void lowmem_vmpressure(gfp_t gfp_mask, unsigned long scanned,
+				     unsigned long reclaimed)
+{
+}
+#endif
 #endif /* __KERNEL__*/
 #endif /* _INCLUDE_LINUX_OOM_H */
@@ -12,20 +12,30 @@
 #define PM_QOS_CPU_DMA_LATENCY 1
 #define PM_QOS_NETWORK_LATENCY 2
 #define PM_QOS_NETWORK_THROUGHPUT 3
+#define PM_QOS_CPU_FREQ_MIN 4
+#define PM_QOS_CPU_FREQ_MAX 5
+#define PM_QOS_BUS_DMC_MIN 6
 
-#define PM_QOS_NUM_CLASSES 4
+#define PM_QOS_NUM_CLASSES 7
 #define PM_QOS_DEFAULT_VALUE -1
 
 #define PM_QOS_CPU_DMA_LAT_DEFAULT_VALUE	(2000 * USEC_PER_SEC)
 #define PM_QOS_NETWORK_LAT_DEFAULT_VALUE	(2000 * USEC_PER_SEC)
 #define PM_QOS_NETWORK_THROUGHPUT_DEFAULT_VALUE	0
+#define PM_QOS_CPU_FREQ_MIN_DEFAULT_VALUE	0
+#define PM_QOS_CPU_FREQ_MAX_DEFAULT_VALUE	INT_MAX
+#define PM_QOS_BUS_DMC_MIN_DEFAULT_VALUE	0
 
 struct pm_qos_request_list {
 	struct plist_node list;
 	int pm_qos_class;
+	const char *name;	/* shown in debugfs, caller used if NULL */
+	void *owner;
 };
 
 void pm_qos_add_request(struct pm_qos_request_list *l, int pm_qos_class, s32 value);
+void pm_qos_add_request_named(struct pm_qos_request_list *l, int pm_qos_class,
+		s32 value, const char *name);
 void pm_qos_update_request(struct pm_qos_request_list *pm_qos_req,
 		s32 new_value);
 void pm_qos_remove_request(struct pm_qos_request_list *pm_qos_req);
@@ -76,6 +76,30 @@ DEFINE_EVENT(loadeval, cpufreq_interactive_notyet,
 	    TP_ARGS(cpu_id, load, curfreq, targfreq)
 );
 
+TRACE_EVENT(cpufreq_interactive_transition,
+	    TP_PROTO(u32 cpu_id, unsigned long oldfreq,
+		     unsigned long newfreq, unsigned int latency),
+	    TP_ARGS(cpu_id, oldfreq, newfreq, latency),
+
+	    TP_STRUCT__entry(
+		    __field(          u32, cpu_id   )
+		    __field(unsigned long, oldfreq  )
+		    __field(unsigned long, newfreq  )
+		    __field( unsigned int, latency  )
+	    ),
+
+	    TP_fast_assign(
+		    __entry->cpu_id = cpu_id;
+		    __entry->oldfreq = oldfreq;
+		    __entry->newfreq = newfreq;
+		    __entry->latency = latency;
+	    ),
+
+	    TP_printk("cpu=%u old=%lu new=%lu latency=%uus",
+		      __entry->cpu_id, __entry->oldfreq, __entry->newfreq,
+		      __entry->latency)
+);
+
 TRACE_EVENT(cpufreq_interactive_boost,
 	    TP_PROTO(const char *s),
 	    TP_ARGS(s),
@@ -13,6 +13,11 @@
  * latency: usec
  * timeout: usec <-- currently not used.
  * throughput: kbs (kilo byte / sec)
+ * frequency: kHz
+ *
+ * The frequency classes carry CPU and memory controller constraints for
+ * platform cpufreq drivers.  Every active request, along with whoever added
+ * it, is listed in debugfs under pm_qos/requests.
  *
  * There are lists of pm_qos_objects each one wrapping requests, notifiers
  *
@@ -41,6 +46,8 @@
 #include <linux/platform_device.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <linux/uaccess.h>
 
@@ -104,11 +111,44 @@ static struct pm_qos_object network_throughput_pm_qos = {
 };
 
 
+static BLOCKING_NOTIFIER_HEAD(cpu_freq_min_notifier);
+static struct pm_qos_object cpu_freq_min_pm_qos = {
+	.requests = PLIST_HEAD_INIT(cpu_freq_min_pm_qos.requests),
+	.notifiers = &cpu_freq_min_notifier,
+	.name = "cpu_freq_min",
+	.target_value = PM_QOS_CPU_FREQ_MIN_DEFAULT_VALUE,
+	.default_value = PM_QOS_CPU_FREQ_MIN_DEFAULT_VALUE,
+	.type = PM_QOS_MAX,
+};
+
+static BLOCKING_NOTIFIER_HEAD(cpu_freq_max_notifier);
+static struct pm_qos_object cpu_freq_max_pm_qos = {
+	.requests = PLIST_HEAD_INIT(cpu_freq_max_pm_qos.requests),
+	.notifiers = &cpu_freq_max_notifier,
+	.name = "cpu_freq_max",
+	.target_value = PM_QOS_CPU_FREQ_MAX_DEFAULT_VALUE,
+	.default_value = PM_QOS_CPU_FREQ_MAX_DEFAULT_VALUE,
+	.type = PM_QOS_MIN,
+};
+
+static BLOCKING_NOTIFIER_HEAD(bus_dmc_min_notifier);
+static struct pm_qos_object bus_dmc_min_pm_qos = {
+	.requests = PLIST_HEAD_INIT(bus_dmc_min_pm_qos.requests),
+	.notifiers = &bus_dmc_min_notifier,
+	.name = "bus_dmc_min",
+	.target_value = PM_QOS_BUS_DMC_MIN_DEFAULT_VALUE,
+	.default_value = PM_QOS_BUS_DMC_MIN_DEFAULT_VALUE,
+	.type = PM_QOS_MAX,
+};
+
 static struct pm_qos_object *pm_qos_array[] = {
 	&null_pm_qos,
 	&cpu_dma_pm_qos,
 	&network_lat_pm_qos,
-	&network_throughput_pm_qos
+	&network_throughput_pm_qos,
+	&cpu_freq_min_pm_qos,
+	&cpu_freq_max_pm_qos,
+	&bus_dmc_min_pm_qos,
 };
 
 static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
@@ -241,8 +281,9 @@ EXPORT_SYMBOL_GPL(pm_qos_request_active);
  * removal.
  */
 
-void pm_qos_add_request(struct pm_qos_request_list *dep,
-			int pm_qos_class, s32 value)
+static void __pm_qos_add_request(struct pm_qos_request_list *dep,
+				 int pm_qos_class, s32 value,
+				 const char *name, void *owner)
 {
 	struct pm_qos_object *o =  pm_qos_array[pm_qos_class];
 	int new_value;
@@ -257,10 +298,38 @@ void pm_qos_add_request(struct pm_qos_request_list *dep,
 		new_value = value;
 	plist_node_init(&dep->list, new_value);
 	dep->pm_qos_class = pm_qos_class;
+	dep->name = name;
+	dep->owner = owner;
 	update_target(o, &dep->list, 0, PM_QOS_DEFAULT_VALUE);
 }
+
+void pm_qos_add_request(struct pm_qos_request_list *dep,
+			int pm_qos_class, s32 value)
+{
+	__pm_qos_add_request(dep, pm_qos_class, value, NULL,
+			     __builtin_return_address(0));
+}
 EXPORT_SYMBOL_GPL(pm_qos_add_request);
 
+/**
+ * pm_qos_add_request_named - inserts a new qos request with an owner tag
+ * @dep: pointer to a preallocated handle
+ * @pm_qos_class: identifies which list of qos request to use
+ * @value: defines the qos request
+ * @name: tag reported for this request in debugfs, must stay valid until
+ *	the request is removed
+ *
+ * Same as pm_qos_add_request(), but the request shows up as @name rather
+ * than as the calling function when the active requests are dumped.
+ */
+void pm_qos_add_request_named(struct pm_qos_request_list *dep,
+			      int pm_qos_class, s32 value, const char *name)
+{
+	__pm_qos_add_request(dep, pm_qos_class, value, name,
+			     __builtin_return_address(0));
+}
+EXPORT_SYMBOL_GPL(pm_qos_add_request_named);
+
 /**
  * pm_qos_update_request - modifies an existing qos request
  * @pm_qos_req : handle to list element holding a pm_qos request to use
@@ -372,7 +441,8 @@ static int pm_qos_power_open(struct inode *inode, struct file *filp)
 		if (!req)
 			return -ENOMEM;
 
-		pm_qos_add_request(req, pm_qos_class, PM_QOS_DEFAULT_VALUE);
+		pm_qos_add_request_named(req, pm_qos_class,
+					 PM_QOS_DEFAULT_VALUE, "userspace");
 		filp->private_data = req;
 
 		if (filp->private_data)
@@ -456,24 +526,75 @@ static ssize_t pm_qos_power_write(struct file *filp, const char __user *buf,
 }
 
 
+#ifdef CONFIG_DEBUG_FS
+static int pm_qos_requests_show(struct seq_file *s, void *unused)
+{
+	struct pm_qos_request_list *req;
+	struct pm_qos_object *o;
+	unsigned long flags;
+	int pm_qos_class;
+
+	spin_lock_irqsave(&pm_qos_lock, flags);
+	for (pm_qos_class = 1;
+		pm_qos_class < PM_QOS_NUM_CLASSES; pm_qos_class++) {
+		o = pm_qos_array[pm_qos_class];
+		seq_printf(s, "%s: %d\n", o->name, pm_qos_get_value(o));
+		plist_for_each_entry(req, &o->requests, list) {
+			if (req->name)
+				seq_printf(s, "  %-24s %d\n", req->name,
+					   req->list.prio);
+			else
+				seq_printf(s, "  %-24pS %d\n", req->owner,
+					   req->list.prio);
+		}
+	}
+	spin_unlock_irqrestore(&pm_qos_lock, flags);
+
+	return 0;
+}
+
+static int pm_qos_requests_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pm_qos_requests_show, NULL);
+}
+
+static const struct file_operations pm_qos_requests_fops = {
+	.open = pm_qos_requests_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void __init pm_qos_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("pm_qos", NULL);
+	if (!dir)
+		return;
+	debugfs_create_file("requests", S_IRUGO, dir, NULL,
+			    &pm_qos_requests_fops);
+}
+#else
+static inline void pm_qos_debugfs_init(void) { }
+#endif
+
 static int __init pm_qos_power_init(void)
 {
 	int ret = 0;
+	int pm_qos_class;
 
-	ret = register_pm_qos_misc(&cpu_dma_pm_qos);
-	if (ret < 0) {
-		printk(KERN_ERR "pm_qos_param: cpu_dma_latency setup failed\n");
-		return ret;
-	}
-	ret = register_pm_qos_misc(&network_lat_pm_qos);
-	if (ret < 0) {
-		printk(KERN_ERR "pm_qos_param: network_latency setup failed\n");
-		return ret;
+	pm_qos_debugfs_init();
+
+	for (pm_qos_class = 1;
+		pm_qos_class < PM_QOS_NUM_CLASSES; pm_qos_class++) {
+		ret = register_pm_qos_misc(pm_qos_array[pm_qos_class]);
+		if (ret < 0) {
+			printk(KERN_ERR "pm_qos_param: %s setup failed\n",
+			       pm_qos_array[pm_qos_class]->name);
+			return ret;
+		}
 	}
-	ret = register_pm_qos_misc(&network_throughput_pm_qos);
-	if (ret < 0)
-		printk(KERN_ERR
-			"pm_qos_param: network_throughput setup failed\n");
 
 	return ret;
 }
@@ -13,9 +13,7 @@
 #include <linux/resume-trace.h>
 #include <linux/workqueue.h>
 
-#ifdef CONFIG_DVFS_LIMIT
-#include <mach/cpu-freq-v210.h>
-#endif
+#include <linux/pm_qos_params.h>
 
 #include "power.h"
 
@@ -318,9 +316,13 @@ power_attr(wake_unlock);
 #endif
 
 #ifdef CONFIG_DVFS_LIMIT
+#define DVFSLOCK_FREQ_HIGH	1000000	/* kHz */
+#define DVFSLOCK_FREQ_LOW	800000
+
 //extern int g_dbs_timer_started;
 static int dvfsctrl_locked = 0;
 static int gdDvfsctrl = 0;
+static struct pm_qos_request_list dvfslock_qos;
 
 static void do_dvfsunlock_timer(struct work_struct *work);
 //static DEFINE_MUTEX (dvfslock_ctrl_mutex);
@@ -340,7 +342,8 @@ static ssize_t dvfslock_ctrl(const char *buf, size_t count)
 	//if (!g_dbs_timer_started) return -EINVAL;
 	if (gdDvfsctrl == 0) {
 		if (dvfsctrl_locked) {
-			s5pv210_unlock_dvfs_high_level(DVFS_LOCK_TOKEN_6);
+			cancel_delayed_work(&dvfslock_crtl_unlock_work);
+			pm_qos_update_request(&dvfslock_qos, PM_QOS_DEFAULT_VALUE);
 			dvfsctrl_locked = 0;
 		}
 		return -EINVAL;
@@ -358,13 +361,17 @@ static ssize_t dvfslock_ctrl(const char *buf, size_t count)
 		return -EINVAL;
 
 	if (dlevel)
-		dlevel = L1;
+		dlevel = DVFSLOCK_FREQ_LOW;
 	else
-		dlevel = L0;
+		dlevel = DVFSLOCK_FREQ_HIGH;
 
-	printk(KERN_DEBUG "%s : level=%d, time=%d\n", __func__, dlevel, dtime_msec);
+	printk(KERN_DEBUG "%s : freq=%d, time=%d\n", __func__, dlevel, dtime_msec);
 
-	s5pv210_lock_dvfs_high_level(DVFS_LOCK_TOKEN_6, dlevel);
+	if (!pm_qos_request_active(&dvfslock_qos))
+		pm_qos_add_request_named(&dvfslock_qos, PM_QOS_CPU_FREQ_MIN,
+					 dlevel, "dvfslock_ctrl");
+	else
+		pm_qos_update_request(&dvfslock_qos, dlevel);
 	dvfsctrl_locked = 1;
 
 	schedule_delayed_work(&dvfslock_crtl_unlock_work, msecs_to_jiffies(dtime_msec));
@@ -377,7 +384,7 @@ static ssize_t dvfslock_ctrl(const char *buf, size_t count)
 static void do_dvfsunlock_timer(struct work_struct *work)
 {
 	dvfsctrl_locked = 0;
-	s5pv210_unlock_dvfs_high_level(DVFS_LOCK_TOKEN_6);
+	pm_qos_update_request(&dvfslock_qos, PM_QOS_DEFAULT_VALUE);
 }
 
 static ssize_t dvfslock_ctrl_show(struct kobject *kobj,
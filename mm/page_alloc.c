@@ -57,6 +57,8 @@
 #include <linux/ftrace_event.h>
 #include <linux/memcontrol.h>
 #include <linux/prefetch.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -639,12 +641,21 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 			batch_free = to_free;
 
 		do {
+			int mt;
+
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
-			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
+			/*
+			 * MIGRATE_MOVABLE list may include MIGRATE_RESERVEs.
+			 * The block may have been isolated since the page went
+			 * on the list, keep it off the free lists in that case.
+			 */
+			mt = get_pageblock_migratetype(page);
+			if (likely(mt != MIGRATE_ISOLATE))
+				mt = page_private(page);
+			__free_one_page(page, zone, 0, mt);
+			trace_mm_page_pcpu_drain(page, 0, mt);
 		} while (--to_free && --batch_free && !list_empty(list));
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
@@ -842,11 +853,17 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
  * This array describes the order lists are fallen back to when
  * the free lists for the desirable migrate type are depleted
  */
-static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
-	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_RESERVE },
-	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_RESERVE },
-	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
-	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
+static int fallbacks[MIGRATE_TYPES][4] = {
+	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,     MIGRATE_RESERVE },
+	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,     MIGRATE_RESERVE },
+#ifdef CONFIG_CMA
+	[MIGRATE_MOVABLE]     = { MIGRATE_CMA,         MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+	[MIGRATE_CMA]         = { MIGRATE_RESERVE }, /* Never used */
+#else
+	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE,   MIGRATE_RESERVE },
+#endif
+	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE }, /* Never used */
+	[MIGRATE_ISOLATE]     = { MIGRATE_RESERVE }, /* Never used */
 };
 
 /*
@@ -941,12 +958,12 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 	/* Find the largest possible block of pages in the other list */
 	for (current_order = MAX_ORDER-1; current_order >= order;
 						--current_order) {
-		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
+		for (i = 0;; i++) {
 			migratetype = fallbacks[start_migratetype][i];
 
 			/* MIGRATE_RESERVE handled later if necessary */
 			if (migratetype == MIGRATE_RESERVE)
-				continue;
+				break;
 
 			area = &(zone->free_area[current_order]);
 			if (list_empty(&area->free_list[migratetype]))
@@ -960,11 +977,15 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			 * If breaking a large block of pages, move all free
 			 * pages to the preferred allocation list. If falling
 			 * back for a reclaimable kernel allocation, be more
-			 * aggressive about taking ownership of free pages
+			 * aggressive about taking ownership of free pages.
+			 *
+			 * MIGRATE_CMA pageblocks are never taken over and
+			 * their free pages stay on their own lists.
 			 */
-			if (unlikely(current_order >= (pageblock_order >> 1)) ||
+			if (!is_migrate_cma(migratetype) &&
+			    (unlikely(current_order >= (pageblock_order >> 1)) ||
 					start_migratetype == MIGRATE_RECLAIMABLE ||
-					page_group_by_mobility_disabled) {
+					page_group_by_mobility_disabled)) {
 				unsigned long pages;
 				pages = move_freepages_block(zone, page,
 								start_migratetype);
@@ -983,11 +1004,14 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			rmv_page_order(page);
 
 			/* Take ownership for orders >= pageblock_order */
-			if (current_order >= pageblock_order)
+			if (current_order >= pageblock_order &&
+			    !is_migrate_cma(migratetype))
 				change_pageblock_range(page, current_order,
 							start_migratetype);
 
-			expand(zone, page, order, current_order, area, migratetype);
+			expand(zone, page, order, current_order, area,
+			       is_migrate_cma(migratetype) ?
+			       migratetype : start_migratetype);
 
 			trace_mm_page_alloc_extfrag(page, order, current_order,
 				start_migratetype, migratetype);
@@ -1059,7 +1083,14 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 			list_add(&page->lru, list);
 		else
 			list_add_tail(&page->lru, list);
-		set_page_private(page, migratetype);
+		/*
+		 * A page borrowed from a CMA pageblock has to go back to
+		 * the CMA lists if it is drained from the pcp list unused.
+		 */
+		if (is_migrate_cma(get_pageblock_migratetype(page)))
+			set_page_private(page, MIGRATE_CMA);
+		else
+			set_page_private(page, migratetype);
 		list = &page->lru;
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
@@ -5548,7 +5579,8 @@ __count_immobile_pages(struct zone *zone, struct page *page, int count)
 	if (zone_idx(zone) == ZONE_MOVABLE)
 		return true;
 
-	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE)
+	if (get_pageblock_migratetype(page) == MIGRATE_MOVABLE ||
+	    is_migrate_cma(get_pageblock_migratetype(page)))
 		return true;
 
 	pfn = page_to_pfn(page);
@@ -5658,7 +5690,7 @@ out:
 	return ret;
 }
 
-void unset_migratetype_isolate(struct page *page)
+void unset_migratetype_isolate(struct page *page, unsigned migratetype)
 {
 	struct zone *zone;
 	unsigned long flags;
@@ -5666,12 +5698,175 @@ void unset_migratetype_isolate(struct page *page)
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
-	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-	move_freepages_block(zone, page, MIGRATE_MOVABLE);
+	set_pageblock_migratetype(page, migratetype);
+	move_freepages_block(zone, page, migratetype);
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
+#ifdef CONFIG_CMA
+
+/* Free up a pageblock set aside at boot as part of a contiguous area */
+void __init init_cma_reserved_pageblock(struct page *page)
+{
+	unsigned i = pageblock_nr_pages;
+	struct page *p = page;
+
+	do {
+		__ClearPageReserved(p);
+		set_page_count(p, 0);
+	} while (++p, --i);
+
+	set_page_refcounted(page);
+	set_pageblock_migratetype(page, MIGRATE_CMA);
+	__free_pages(page, pageblock_order);
+	totalram_pages += pageblock_nr_pages;
+}
+
+static struct page *
+alloc_contig_migrate_alloc(struct page *page, unsigned long private, int **x)
+{
+	return alloc_page(GFP_HIGHUSER_MOVABLE);
+}
+
+#define NR_CONTIG_MIGRATE_PAGES	256
+
+/* Move whatever sits on the LRU in [start, end) somewhere else */
+static int alloc_contig_migrate_range(unsigned long start, unsigned long end)
+{
+	unsigned long pfn = start;
+	int ret = 0;
+	LIST_HEAD(source);
+
+	migrate_prep();
+
+	while (pfn < end) {
+		int nr = 0;
+
+		if (fatal_signal_pending(current))
+			return -EINTR;
+
+		for (; pfn < end && nr < NR_CONTIG_MIGRATE_PAGES; pfn++) {
+			struct page *page;
+
+			if (!pfn_valid_within(pfn))
+				continue;
+			page = pfn_to_page(pfn);
+			if (!PageLRU(page) || !get_page_unless_zero(page))
+				continue;
+
+			if (!isolate_lru_page(page)) {
+				list_add_tail(&page->lru, &source);
+				inc_zone_page_state(page, NR_ISOLATED_ANON +
+						    page_is_file_cache(page));
+				nr++;
+			}
+			put_page(page);
+		}
+
+		if (list_empty(&source))
+			continue;
+
+		/* this function returns # of failed pages */
+		ret = migrate_pages(&source, alloc_contig_migrate_alloc, 0,
+				    false, true);
+		if (ret) {
+			putback_lru_pages(&source);
+			ret = -EBUSY;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Take every page of [start, end) off the free lists. Fails if any of
+ * them is still in use; the caller migrates again and retries.
+ */
+static int alloc_contig_take_free(struct zone *zone,
+				  unsigned long start, unsigned long end)
+{
+	unsigned long flags, pfn;
+	struct page *page;
+	int order;
+
+	spin_lock_irqsave(&zone->lock, flags);
+
+	for (pfn = start; pfn < end; pfn += 1UL << page_order(page)) {
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page)) {
+			spin_unlock_irqrestore(&zone->lock, flags);
+			return -EBUSY;
+		}
+	}
+
+	for (pfn = start; pfn < end; pfn += 1UL << order) {
+		page = pfn_to_page(pfn);
+		order = page_order(page);
+
+		list_del(&page->lru);
+		zone->free_area[order].nr_free--;
+		rmv_page_order(page);
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1L << order));
+
+		set_page_refcounted(page);
+		split_page(page, order);
+	}
+
+	spin_unlock_irqrestore(&zone->lock, flags);
+	return 0;
+}
+
+#define NR_CONTIG_RETRIES	5
+
+/**
+ * alloc_contig_range() -- tries to allocate given range of pages
+ * @start:	start PFN to allocate
+ * @end:	one-past-the-last PFN to allocate
+ *
+ * Both ends must be pageblock aligned and the range must lie in
+ * MIGRATE_CMA pageblocks of a single zone. Pages in use are migrated
+ * out first. On success every page of the range is allocated with a
+ * reference count of one; give them back with free_contig_range().
+ */
+int alloc_contig_range(unsigned long start, unsigned long end)
+{
+	struct zone *zone = page_zone(pfn_to_page(start));
+	int tries, ret;
+
+	if (WARN_ON((start | end) & (pageblock_nr_pages - 1)))
+		return -EINVAL;
+
+	ret = start_isolate_page_range(start, end, MIGRATE_CMA);
+	if (ret)
+		return ret;
+
+	for (tries = 0; tries < NR_CONTIG_RETRIES; tries++) {
+		ret = alloc_contig_migrate_range(start, end);
+		if (ret == -EINTR)
+			break;
+
+		/* Pull back whatever sits on the pcp and pagevec lists */
+		lru_add_drain_all();
+		drain_all_pages();
+
+		ret = alloc_contig_take_free(zone, start, end);
+		if (!ret)
+			break;
+	}
+
+	undo_isolate_page_range(start, end, MIGRATE_CMA);
+	return ret;
+}
+
+void free_contig_range(unsigned long pfn, unsigned long nr_pages)
+{
+	for (; nr_pages--; ++pfn)
+		__free_page(pfn_to_page(pfn));
+}
+
+#endif /* CONFIG_CMA */
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * All pages in the range must be isolated before calling this.
@@ -1977,6 +1977,10 @@ restart:
 	if (inactive_anon_is_low(zone, sc))
 		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
 
+	if (scanning_global_lru(sc))
+		lowmem_vmpressure(sc->gfp_mask, sc->nr_scanned - nr_scanned,
+				  nr_reclaimed);
+
 	/* reclaim/compaction might need reclaim to continue */
 	if (should_continue_reclaim(zone, nr_reclaimed,
 					sc->nr_scanned - nr_scanned, sc))